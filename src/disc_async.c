@@ -0,0 +1,194 @@
+/* Asynchronous disc writes:
+ *
+ * Sector writes from the emulator are copied into a slot of a small staging
+ * buffer and completed later by core 0 between frames. Slots are written out
+ * in the order they were filled; a sector rewritten while being written out
+ * gets a new slot so that the card always ends up with the latest data.
+ * Reads see staged data. The card itself is only accessed with sd_lock held,
+ * which also keeps slots from being retired while a read is overlaying them.
+ */
+
+#include <string.h>
+
+#include "pico/critical_section.h"
+#include "pico/mutex.h"
+#include "pico/time.h"
+#include "hardware/sync.h"
+
+#include "disc_async.h"
+#include "disc_cache.h"
+#include "disc_sd.h"
+#include "log.h"
+
+#define SECTOR_SIZE 512
+#define SYNC_TIMEOUT_US 2000000
+
+typedef int (*disc_op_t)(void *ctx, uint8_t *data, unsigned int offset, unsigned int len);
+
+typedef struct {
+  void *ctx;
+  disc_op_t read;
+  disc_op_t write;
+} backend_t;
+
+enum { SLOT_FREE, SLOT_STAGED, SLOT_WRITING };
+
+typedef struct {
+  uint32_t sector;
+  uint32_t seq;       // fill order, written out oldest first
+  uint8_t drive;
+  volatile uint8_t state;
+  uint8_t data[SECTOR_SIZE] __attribute__((aligned(4)));
+} slot_t;
+
+static backend_t backends[DISC_SD_SLOTS];
+static slot_t slots[DISC_STAGE_SECTORS];
+static uint32_t next_seq = 0;
+static int attached = 0;
+
+static critical_section_t slots_lock; // slot states, held for a few instructions only
+static mutex_t sd_lock;              // the card, held for whole transfers
+
+static volatile int sync_requested = 0;
+
+// latest copy of a sector, staged or being written, with slots_lock held
+static slot_t *find(int drive, uint32_t sector) {
+  slot_t *found = NULL;
+  for (int i = 0; i < DISC_STAGE_SECTORS; i++) {
+    slot_t *s = &slots[i];
+    if (s->state != SLOT_FREE && s->drive == drive && s->sector == sector && (!found || s->seq > found->seq))
+      found = s;
+  }
+  return found;
+}
+
+static slot_t *find_free() {
+  for (int i = 0; i < DISC_STAGE_SECTORS; i++)
+    if (slots[i].state == SLOT_FREE) return &slots[i];
+  return NULL;
+}
+
+static int pending() {
+  int n = 0;
+  for (int i = 0; i < DISC_STAGE_SECTORS; i++)
+    if (slots[i].state != SLOT_FREE) n++;
+  return n;
+}
+
+static int staged_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  backend_t *b = ctx;
+  int drive = b - backends;
+  mutex_enter_blocking(&sd_lock);
+  int r = b->read(b->ctx, data, offset, len);
+  if (r == 0) {
+    // overlay what has not reached the card yet, whole sectors or parts of them
+    critical_section_enter_blocking(&slots_lock);
+    for (uint32_t sector = offset / SECTOR_SIZE; sector * SECTOR_SIZE < offset + len; sector++) {
+      slot_t *s = find(drive, sector);
+      if (!s) continue;
+      unsigned int start = sector * SECTOR_SIZE > offset ? sector * SECTOR_SIZE : offset;
+      unsigned int end = (sector + 1) * SECTOR_SIZE < offset + len ? (sector + 1) * SECTOR_SIZE : offset + len;
+      memcpy(data + start - offset, s->data + start - sector * SECTOR_SIZE, end - start);
+    }
+    critical_section_exit(&slots_lock);
+  }
+  mutex_exit(&sd_lock);
+  return r;
+}
+
+static int staged_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  backend_t *b = ctx;
+  int drive = b - backends;
+  if ((offset | len) % SECTOR_SIZE) {
+    // partial sectors are rare, let everything staged land first and write synchronously
+    while (pending()) __wfe();
+    mutex_enter_blocking(&sd_lock);
+    int r = b->write(b->ctx, data, offset, len);
+    mutex_exit(&sd_lock);
+    return r;
+  }
+
+  for (unsigned int i = 0; i < len / SECTOR_SIZE; i++) {
+    uint32_t sector = offset / SECTOR_SIZE + i;
+    for (;;) {
+      critical_section_enter_blocking(&slots_lock);
+      slot_t *s = find(drive, sector);
+      if (!s || s->state == SLOT_WRITING) {
+        s = find_free();
+        if (s) {
+          s->drive = drive;
+          s->sector = sector;
+          s->seq = next_seq++;
+        }
+      }
+      if (s) {
+        // core 0 never touches a staged slot's data before marking it as being written
+        memcpy(s->data, data + i * SECTOR_SIZE, SECTOR_SIZE);
+        s->state = SLOT_STAGED;
+        critical_section_exit(&slots_lock);
+        break;
+      }
+      critical_section_exit(&slots_lock);
+      __wfe(); // full, wait for core 0 to retire a slot
+    }
+  }
+  return 0;
+}
+
+void disc_async_attach(disc_descr_t *disc, int drive) {
+  if (!attached) {
+    critical_section_init(&slots_lock);
+    mutex_init(&sd_lock);
+    attached = 1;
+  }
+  backends[drive] = (backend_t) {disc->op_ctx, disc->op_read, disc->op_write};
+  disc->op_ctx = &backends[drive];
+  disc->op_read = staged_read;
+  if (!disc->read_only) disc->op_write = staged_write;
+}
+
+int disc_async_service() {
+  if (!attached) return 0;
+  for (int n = 0; n < DISC_STAGE_SECTORS; n++) {
+    critical_section_enter_blocking(&slots_lock);
+    slot_t *oldest = NULL;
+    for (int i = 0; i < DISC_STAGE_SECTORS; i++)
+      if (slots[i].state == SLOT_STAGED && (!oldest || slots[i].seq < oldest->seq)) oldest = &slots[i];
+    if (oldest) oldest->state = SLOT_WRITING;
+    critical_section_exit(&slots_lock);
+    if (!oldest) break;
+
+    backend_t *b = &backends[oldest->drive];
+    mutex_enter_blocking(&sd_lock);
+    if (b->write(b->ctx, oldest->data, oldest->sector * SECTOR_SIZE, SECTOR_SIZE) != 0)
+      LOG_ERROR("disc: staged write of sector %lu on drive %d lost\n", oldest->sector, oldest->drive);
+    oldest->state = SLOT_FREE;
+    mutex_exit(&sd_lock);
+    __sev();
+  }
+  return pending();
+}
+
+void disc_async_poll() {
+  if (sync_requested) {
+    disc_cache_flush();
+    sync_requested = 0;
+  }
+}
+
+void disc_sync() {
+  if (!attached) return;
+  // core 1 owns the cache, have it pushed into the staging buffer while servicing it
+  sync_requested = 1;
+  absolute_time_t timeout = make_timeout_time_us(SYNC_TIMEOUT_US);
+  while (sync_requested && !time_reached(timeout)) disc_async_service();
+  while (disc_async_service() && !time_reached(timeout));
+}
+
+void disc_async_lock() {
+  if (attached) mutex_enter_blocking(&sd_lock);
+}
+
+void disc_async_unlock() {
+  if (attached) mutex_exit(&sd_lock);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "umac.h"
+
+// Writes to SD discs are staged in RAM and done by core 0, so the emulation on
+// core 1 only waits when all the staging slots are in use.
+#ifndef DISC_STAGE_SECTORS
+#define DISC_STAGE_SECTORS 16
+#endif
+
+// Route a drive's ops through the staging buffer, the original ops are then
+// only called with the SD card lock held
+void disc_async_attach(disc_descr_t *disc, int drive);
+// Core 0: write out the sectors staged so far, returns how many are left
+int disc_async_service();
+// Core 1: answers disc_sync() requests, to be called regularly
+void disc_async_poll();
+// Core 0: get every pending write (cached and staged) onto the card, before a reset or power off
+void disc_sync();
+// Hold the SD card for accesses that do not go through the disc ops
+void disc_async_lock();
+void disc_async_unlock();
@@ -0,0 +1,188 @@
+/* Disc sector cache:
+ *
+ * Sits between umac's disc driver and the SD card ops so that sectors read
+ * again and again (resource maps, the Finder) do not go through FatFs each
+ * time. 4-way set associative with LRU replacement within a set; writes stay
+ * in the cache until the sector is evicted or disc_cache_flush() is called.
+ * Runs of missing sectors are fetched with a single backing store read.
+ */
+
+#include <string.h>
+
+#include "disc_cache.h"
+
+#define SECTOR_SIZE 512
+#define CACHE_WAYS 4
+#define CACHE_LINES (DISC_CACHE_KB * 1024 / SECTOR_SIZE)
+#define CACHE_SETS (CACHE_LINES / CACHE_WAYS)
+
+typedef int (*disc_op_t)(void *ctx, uint8_t *data, unsigned int offset, unsigned int len);
+
+typedef struct {
+  void *ctx;
+  disc_op_t read;
+  disc_op_t write;
+} backend_t;
+
+typedef struct {
+  uint32_t sector;
+  uint32_t stamp;     // last use, the smallest in a set is evicted
+  uint8_t drive;
+  uint8_t valid;
+  uint8_t dirty;
+} line_t;
+
+disc_cache_stats_t disc_cache_stats;
+
+#if CACHE_SETS > 0
+
+static backend_t backends[DISC_NUM_DRIVES];
+static line_t lines[CACHE_SETS * CACHE_WAYS];
+static uint32_t lru_clock = 0;
+
+#ifdef USE_PSRAM
+#define cache_data ((uint8_t (*)[SECTOR_SIZE]) (0x11000000 + UMAC_MEMSIZE * 1024))
+#else
+static uint8_t cache_data[CACHE_SETS * CACHE_WAYS][SECTOR_SIZE] __attribute__((aligned(4)));
+#endif
+
+static inline line_t *set_of(int drive, uint32_t sector) {
+  return &lines[((sector ^ (drive << 5)) % CACHE_SETS) * CACHE_WAYS];
+}
+
+static line_t *lookup(int drive, uint32_t sector) {
+  line_t *set = set_of(drive, sector);
+  for (int w = 0; w < CACHE_WAYS; w++)
+    if (set[w].valid && set[w].sector == sector && set[w].drive == drive) {
+      set[w].stamp = ++lru_clock;
+      return &set[w];
+    }
+  return NULL;
+}
+
+static int write_back(line_t *line) {
+  backend_t *b = &backends[line->drive];
+  int r = b->write(b->ctx, cache_data[line - lines], line->sector * SECTOR_SIZE, SECTOR_SIZE);
+  if (r == 0) {
+    line->dirty = 0;
+    disc_cache_stats.writebacks++;
+  }
+  return r;
+}
+
+// a line for the sector, emptied of whatever it held before
+static line_t *allocate(int drive, uint32_t sector) {
+  line_t *set = set_of(drive, sector);
+  line_t *victim = &set[0];
+  for (int w = 0; w < CACHE_WAYS; w++) {
+    if (!set[w].valid) {
+      victim = &set[w];
+      break;
+    }
+    if (set[w].stamp < victim->stamp) victim = &set[w];
+  }
+  if (victim->valid) {
+    disc_cache_stats.evictions++;
+    if (victim->dirty && write_back(victim) != 0) return NULL;
+  }
+  victim->drive = drive;
+  victim->sector = sector;
+  victim->valid = 1;
+  victim->dirty = 0;
+  victim->stamp = ++lru_clock;
+  return victim;
+}
+
+static int cached_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  backend_t *b = ctx;
+  int drive = b - backends;
+  if ((offset | len) % SECTOR_SIZE) {
+    int r = disc_cache_flush(); // the backing store must not be older than the cache
+    return r != 0 ? r : b->read(b->ctx, data, offset, len);
+  }
+
+  uint32_t sector = offset / SECTOR_SIZE;
+  uint32_t count = len / SECTOR_SIZE;
+  for (uint32_t i = 0; i < count;) {
+    line_t *line = lookup(drive, sector + i);
+    if (line) {
+      disc_cache_stats.hits++;
+      memcpy(data + i * SECTOR_SIZE, cache_data[line - lines], SECTOR_SIZE);
+      i++;
+      continue;
+    }
+    // fetch the whole run of missing sectors at once, straight into the caller's buffer
+    uint32_t run = 1;
+    while (i + run < count && !lookup(drive, sector + i + run)) run++;
+    int r = b->read(b->ctx, data + i * SECTOR_SIZE, (sector + i) * SECTOR_SIZE, run * SECTOR_SIZE);
+    if (r != 0) return r;
+    disc_cache_stats.misses += run;
+    for (uint32_t j = i; j < i + run; j++) {
+      line = allocate(drive, sector + j);
+      if (line) memcpy(cache_data[line - lines], data + j * SECTOR_SIZE, SECTOR_SIZE);
+    }
+    i += run;
+  }
+  return 0;
+}
+
+static int cached_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  backend_t *b = ctx;
+  int drive = b - backends;
+  if ((offset | len) % SECTOR_SIZE) {
+    // rare enough to go around the cache, after making sure it holds nothing older
+    int r = disc_cache_flush();
+    if (r != 0) return r;
+    for (unsigned int s = offset / SECTOR_SIZE; s * SECTOR_SIZE < offset + len; s++) {
+      line_t *line = lookup(drive, s);
+      if (line) line->valid = 0;
+    }
+    return b->write(b->ctx, data, offset, len);
+  }
+
+  for (unsigned int i = 0; i < len / SECTOR_SIZE; i++) {
+    uint32_t sector = offset / SECTOR_SIZE + i;
+    line_t *line = lookup(drive, sector);
+    if (!line) line = allocate(drive, sector);
+    if (!line) {
+      // no line to be had in this set: this sector goes through, the others still get cached
+      int r = b->write(b->ctx, data + i * SECTOR_SIZE, sector * SECTOR_SIZE, SECTOR_SIZE);
+      if (r != 0) return r;
+      continue;
+    }
+    memcpy(cache_data[line - lines], data + i * SECTOR_SIZE, SECTOR_SIZE);
+    line->dirty = 1;
+  }
+  return 0;
+}
+
+void disc_cache_attach(disc_descr_t *disc, int drive) {
+  backends[drive] = (backend_t) {disc->op_ctx, disc->op_read, disc->op_write};
+  disc->op_ctx = &backends[drive];
+  disc->op_read = cached_read;
+  if (!disc->read_only) disc->op_write = cached_write;
+}
+
+int disc_cache_flush() {
+  int result = 0;
+  for (int i = 0; i < CACHE_SETS * CACHE_WAYS; i++) {
+    if (lines[i].valid && lines[i].dirty) {
+      int r = write_back(&lines[i]);
+      if (r != 0 && result == 0) result = r;
+    }
+  }
+  return result;
+}
+
+#else
+
+void disc_cache_attach(disc_descr_t *disc, int drive) {
+  (void) disc;
+  (void) drive;
+}
+
+int disc_cache_flush() {
+  return 0;
+}
+
+#endif
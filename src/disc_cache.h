@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "umac.h"
+
+// Write-back sector cache shared by all drives, DISC_CACHE_KB in size
+// (0 disables it). Lives in PSRAM after the Mac's memory with USE_PSRAM.
+#ifndef DISC_CACHE_KB
+#define DISC_CACHE_KB 8
+#endif
+
+typedef struct {
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t evictions;
+  uint32_t writebacks;
+} disc_cache_stats_t;
+
+extern disc_cache_stats_t disc_cache_stats;
+
+// Route a drive's op_read/op_write through the cache, the original ops become the backing store
+void disc_cache_attach(disc_descr_t *disc, int drive);
+// Write dirty sectors back, returns 0 or the first backing store error
+int disc_cache_flush();
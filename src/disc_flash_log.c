@@ -0,0 +1,432 @@
+/* Log-structured flash disc:
+ *
+ * The log is made of 4 KB segments, the flash erase unit, each programmed in
+ * one go: a header page naming the disc sectors held in the 7 slots that
+ * follow, with a sequence number. At boot the headers are applied in sequence
+ * order to a remap table (disc sector -> slot), so that the latest copy of a
+ * sector wins; sectors not in the log come from the disc underneath.
+ *
+ * Core 1 stages written sectors in RAM, where reads find them first. Core 0
+ * programs the least worn free segment with them under flash_safe_execute(),
+ * which parks core 1 outside flash meanwhile, then updates the remap table.
+ * When free segments run low, the live sectors of the segment with the fewest
+ * of them are staged again to free it; every so often the segment with the
+ * least wear is freed the same way, so that static data does not keep it out
+ * of use. The header is programmed last: a segment cut short by a reset has
+ * no valid header and is simply reused. Builds on the host as well, over a
+ * flash image in RAM.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef PICO
+#include "pico/critical_section.h"
+#include "pico/flash.h"
+#include "pico/time.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#else
+// host builds (tools/disc-flash-log-test.c): one thread, the test provides the
+// flash, its clock and what the guest does while it waits for core 0
+#include <stdint.h>
+
+#define __not_in_flash_func(f) f
+#define FLASH_SECTOR_SIZE 4096
+#define FLASH_PAGE_SIZE 256
+#define PICO_FLASH_SIZE_BYTES (FLASH_LOG_KB * 1024)
+#define PICO_OK 0
+extern uint8_t flash_image[PICO_FLASH_SIZE_BYTES];
+#define XIP_BASE ((uintptr_t) flash_image)
+#define __flash_binary_end flash_image[0]
+typedef int critical_section_t;
+#define critical_section_init(lock) (void) (lock)
+#define critical_section_enter_blocking(lock) (void) (lock)
+#define critical_section_exit(lock) (void) (lock)
+#define __sev() do { } while (0)
+#define __wfe() flash_log_host_wait()
+void flash_range_erase(uint32_t offset, size_t count);
+void flash_range_program(uint32_t offset, const uint8_t *data, size_t count);
+int flash_safe_execute(void (*func)(void *), void *param, uint32_t timeout_ms);
+uint32_t time_us_32();
+void flash_log_host_wait();
+#endif
+
+#include "disc_flash_log.h"
+#include "log.h"
+
+#define SECTOR_SIZE 512
+#define SEG_SIZE FLASH_SECTOR_SIZE
+#define SEG_SLOTS (SEG_SIZE / SECTOR_SIZE - 1)
+#define SEG_COUNT (FLASH_LOG_KB * 1024 / SEG_SIZE)
+#define LOG_OFFSET (PICO_FLASH_SIZE_BYTES - SEG_COUNT * SEG_SIZE)
+#define SEG_MAGIC 0x474f4c55  // "ULOG"
+#define FREE_RESERVE 2        // free segments below which garbage is collected
+#define WEAR_INTERVAL 64      // commits between two wear levelling moves
+#define WEAR_DELTA 16         // erase count gap for a segment to be moved
+#define IDLE_COMMIT_US 1000000
+#define SAFE_TIMEOUT_MS 100
+
+#if FLASH_LOG_STAGE_SECTORS < 2 * SEG_SLOTS
+#error "FLASH_LOG_STAGE_SECTORS must hold two segments"
+#endif
+
+typedef struct {
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t erases;
+  uint32_t base_id;   // the disc the log was written over
+  uint32_t sectors[SEG_SLOTS];
+  uint32_t check;
+} seg_header_t;
+
+enum { STAGE_FREE, STAGE_STAGED, STAGE_COMMITTING };
+
+typedef struct {
+  uint32_t sector;
+  uint32_t seq;       // stage order, the latest copy of a sector wins
+  volatile uint8_t state;
+  uint8_t data[SECTOR_SIZE] __attribute__((aligned(4)));
+} stage_t;
+
+typedef struct {
+  int seg;
+  int count;
+  stage_t *slots[SEG_SLOTS];
+  uint8_t header[FLASH_PAGE_SIZE] __attribute__((aligned(4)));
+} commit_t;
+
+#ifdef PICO
+extern char __flash_binary_end;
+#endif
+
+disc_flash_log_stats_t disc_flash_log_stats;
+
+static void *base_ctx;
+static int (*base_read)(void *ctx, uint8_t *data, unsigned int offset, unsigned int len);
+static uint32_t disc_sectors;
+static uint32_t base_id;
+
+static uint16_t *remap;       // slot + 1 for each disc sector, 0 when not in the log
+static uint8_t live[SEG_COUNT];
+static uint32_t erases[SEG_COUNT];
+static uint32_t next_seq = 1;
+
+static stage_t stage[FLASH_LOG_STAGE_SECTORS];
+static uint32_t stage_seq = 0;   // 0 is for sectors moved by garbage collection
+static volatile uint32_t last_write_us;
+static volatile int log_full = 0;
+static critical_section_t log_lock;
+static int attached = 0;
+static commit_t job;
+
+static inline const seg_header_t *seg_header(int seg) {
+  return (const seg_header_t *) (XIP_BASE + LOG_OFFSET + seg * SEG_SIZE);
+}
+
+static inline const uint8_t *slot_data(uint32_t slot) {
+  return (const uint8_t *) seg_header(slot / SEG_SLOTS) + (slot % SEG_SLOTS + 1) * SECTOR_SIZE;
+}
+
+static uint32_t header_check(const seg_header_t *h) {
+  const uint32_t *w = (const uint32_t *) h;
+  uint32_t sum = 0x5eed;
+  for (unsigned int i = 0; i < offsetof(seg_header_t, check) / 4; i++) sum = (sum << 5 | sum >> 27) ^ w[i];
+  return sum;
+}
+
+// latest staged copy of a sector, with log_lock held
+static stage_t *find_staged(uint32_t sector) {
+  stage_t *found = NULL;
+  for (int i = 0; i < FLASH_LOG_STAGE_SECTORS; i++) {
+    stage_t *s = &stage[i];
+    if (s->state != STAGE_FREE && s->sector == sector && (!found || s->seq > found->seq)) found = s;
+  }
+  return found;
+}
+
+// with log_lock held, returns -1 when there is no slot left. The last
+// segment's worth of slots is kept for garbage collection, whose sectors
+// go out first so that the segment they come from is freed at once.
+static int stage_put(uint32_t sector, const uint8_t *data, int moved) {
+  stage_t *s = find_staged(sector);
+  if (!s || s->state != STAGE_STAGED) {
+    int used = 0;
+    s = NULL;
+    for (int i = 0; i < FLASH_LOG_STAGE_SECTORS; i++) {
+      if (stage[i].state != STAGE_FREE) used++;
+      else if (!s) s = &stage[i];
+    }
+    if (!s || (!moved && used >= FLASH_LOG_STAGE_SECTORS - SEG_SLOTS)) return -1;
+    s->sector = sector;
+    s->seq = moved ? 0 : ++stage_seq;
+  }
+  memcpy(s->data, data, SECTOR_SIZE);
+  s->state = STAGE_STAGED;
+  return 0;
+}
+
+static int log_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  (void) ctx;
+  if (offset + len > disc_sectors * SECTOR_SIZE) return -1;
+  while (len > 0) {
+    uint32_t sector = offset / SECTOR_SIZE;
+    unsigned int skip = offset % SECTOR_SIZE;
+    unsigned int n = SECTOR_SIZE - skip < len ? SECTOR_SIZE - skip : len;
+    critical_section_enter_blocking(&log_lock);
+    stage_t *s = find_staged(sector);
+    const uint8_t *src = s ? s->data : remap[sector] ? slot_data(remap[sector] - 1) : NULL;
+    if (src) {
+      memcpy(data, src + skip, n);
+    } else {
+      // sectors that follow and are not in the log either go in the same read underneath
+      while (n < len && !remap[sector + 1] && !find_staged(sector + 1)) {
+        sector++;
+        n += len - n < SECTOR_SIZE ? len - n : SECTOR_SIZE;
+      }
+    }
+    critical_section_exit(&log_lock);
+    if (!src && base_read(base_ctx, data, offset, n) != 0) return -1;
+    data += n;
+    offset += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int log_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  uint8_t partial[SECTOR_SIZE] __attribute__((aligned(4)));
+  if (offset + len > disc_sectors * SECTOR_SIZE) return -1;
+  while (len > 0) {
+    uint32_t sector = offset / SECTOR_SIZE;
+    unsigned int skip = offset % SECTOR_SIZE;
+    unsigned int n = SECTOR_SIZE - skip < len ? SECTOR_SIZE - skip : len;
+    const uint8_t *src = data;
+    if (n < SECTOR_SIZE) {
+      if (log_read(ctx, partial, sector * SECTOR_SIZE, SECTOR_SIZE) != 0) return -1;
+      memcpy(partial + skip, data, n);
+      src = partial;
+    }
+    for (;;) {
+      critical_section_enter_blocking(&log_lock);
+      int r = stage_put(sector, src, 0);
+      critical_section_exit(&log_lock);
+      if (r == 0) break;
+      if (log_full) {
+        LOG_ERROR("disc: flash log full, write of sector %lu lost\n", sector);
+        return -1;
+      }
+      __wfe(); // wait for core 0 to commit
+    }
+    last_write_us = time_us_32();
+    data += n;
+    offset += n;
+    len -= n;
+  }
+  return 0;
+}
+
+// Garbage collection and wear levelling (core 0)
+
+static int free_segments() {
+  int n = 0;
+  for (int seg = 0; seg < SEG_COUNT; seg++)
+    if (!live[seg]) n++;
+  return n;
+}
+
+static int pick_victim() {
+  static uint32_t commits_since_move = 0;
+  int victim = -1;
+  if (free_segments() <= FREE_RESERVE) {
+    for (int seg = 0; seg < SEG_COUNT; seg++) {
+      if (live[seg] && live[seg] < SEG_SLOTS && (victim < 0 || live[seg] < live[victim] ||
+          (live[seg] == live[victim] && erases[seg] < erases[victim]))) victim = seg;
+    }
+    return victim;
+  }
+  if (++commits_since_move < WEAR_INTERVAL) return -1;
+  commits_since_move = 0;
+  for (int seg = 0; seg < SEG_COUNT; seg++)
+    if (live[seg] && (victim < 0 || erases[seg] < erases[victim])) victim = seg;
+  return victim >= 0 && disc_flash_log_stats.max_erases - erases[victim] > WEAR_DELTA ? victim : -1;
+}
+
+// stage the sectors still mapped to victim again, so that it is free once they are committed
+static void collect(int victim) {
+  const seg_header_t *h = seg_header(victim);
+  critical_section_enter_blocking(&log_lock);
+  for (int i = 0; i < SEG_SLOTS; i++) {
+    uint32_t sector = h->sectors[i];
+    if (sector >= disc_sectors || remap[sector] != victim * SEG_SLOTS + i + 1) continue;
+    stage_t *s = find_staged(sector);
+    if (s) {
+      s->seq = 0; // rewritten already, but it has to go out with the others
+    } else if (stage_put(sector, slot_data(remap[sector] - 1), 1) == 0) {
+      disc_flash_log_stats.moved++;
+    }
+  }
+  critical_section_exit(&log_lock);
+}
+
+static void __not_in_flash_func(program_segment)(void *param) {
+  commit_t *c = param;
+  uint32_t offset = LOG_OFFSET + c->seg * SEG_SIZE;
+  flash_range_erase(offset, SEG_SIZE);
+  for (int i = 0; i < c->count; i++)
+    flash_range_program(offset + (i + 1) * SECTOR_SIZE, c->slots[i]->data, SECTOR_SIZE);
+  flash_range_program(offset, c->header, FLASH_PAGE_SIZE);
+}
+
+static void update_wear_stats() {
+  disc_flash_log_stats.min_erases = ~0u;
+  disc_flash_log_stats.max_erases = 0;
+  for (int seg = 0; seg < SEG_COUNT; seg++) {
+    if (erases[seg] < disc_flash_log_stats.min_erases) disc_flash_log_stats.min_erases = erases[seg];
+    if (erases[seg] > disc_flash_log_stats.max_erases) disc_flash_log_stats.max_erases = erases[seg];
+  }
+}
+
+// program one segment with the oldest staged sectors, returns how many
+static int commit() {
+  job.seg = -1;
+  for (int seg = 0; seg < SEG_COUNT; seg++)
+    if (!live[seg] && (job.seg < 0 || erases[seg] < erases[job.seg])) job.seg = seg;
+  log_full = job.seg < 0;
+  if (log_full) {
+    __sev();
+    return 0;
+  }
+
+  seg_header_t *h = (seg_header_t *) job.header;
+  memset(job.header, 0xff, FLASH_PAGE_SIZE);
+  critical_section_enter_blocking(&log_lock);
+  for (job.count = 0; job.count < SEG_SLOTS; job.count++) {
+    stage_t *oldest = NULL;
+    for (int i = 0; i < FLASH_LOG_STAGE_SECTORS; i++)
+      if (stage[i].state == STAGE_STAGED && (!oldest || stage[i].seq < oldest->seq)) oldest = &stage[i];
+    if (!oldest) break;
+    oldest->state = STAGE_COMMITTING; // core 1 leaves it alone from now on
+    job.slots[job.count] = oldest;
+    h->sectors[job.count] = oldest->sector;
+  }
+  critical_section_exit(&log_lock);
+  if (!job.count) return 0;
+
+  h->magic = SEG_MAGIC;
+  h->seq = next_seq;
+  h->erases = erases[job.seg] + 1;
+  h->base_id = base_id;
+  h->check = header_check(h);
+  int r = flash_safe_execute(program_segment, &job, SAFE_TIMEOUT_MS);
+
+  critical_section_enter_blocking(&log_lock);
+  for (int i = 0; i < job.count; i++) {
+    stage_t *s = job.slots[i];
+    if (r == PICO_OK) {
+      uint16_t old = remap[s->sector];
+      if (old) live[(old - 1) / SEG_SLOTS]--;
+      remap[s->sector] = job.seg * SEG_SLOTS + i + 1;
+      live[job.seg]++;
+    }
+    // a sector rewritten meanwhile has a newer copy, this one is kept until the next try otherwise
+    s->state = r == PICO_OK ? STAGE_FREE : STAGE_STAGED;
+  }
+  critical_section_exit(&log_lock);
+  __sev();
+
+  if (r != PICO_OK) {
+    LOG_ERROR("disc: flash log commit failed (%d)\n", r);
+    return 0;
+  }
+  next_seq++;
+  erases[job.seg]++;
+  disc_flash_log_stats.commits++;
+  update_wear_stats();
+  LOG_DEBUG("disc: %d sectors committed to flash segment %d\n", job.count, job.seg);
+  return job.count;
+}
+
+static int staged_sectors() {
+  int staged = 0;
+  for (int i = 0; i < FLASH_LOG_STAGE_SECTORS; i++)
+    if (stage[i].state == STAGE_STAGED) staged++;
+  return staged;
+}
+
+// garbage is collected on the way, or commits would use up the free segments it needs
+static int collect_and_commit() {
+  int victim = pick_victim();
+  if (victim >= 0) collect(victim);
+  return commit();
+}
+
+void disc_flash_log_service() {
+  if (!attached) return;
+  int staged = staged_sectors();
+  if (!staged || (staged < SEG_SLOTS && time_us_32() - last_write_us < IDLE_COMMIT_US)) return;
+  collect_and_commit();
+}
+
+void disc_flash_log_sync() {
+  if (!attached) return;
+  while (staged_sectors() && collect_and_commit() > 0);
+}
+
+int disc_flash_log_attach(disc_descr_t *disc) {
+  if (SEG_COUNT < FREE_RESERVE + 2 || LOG_OFFSET < (uintptr_t) &__flash_binary_end - XIP_BASE) {
+    printf("no room for the flash log after the firmware\n");
+    return -1;
+  }
+  uint32_t start_us = time_us_32();
+  base_ctx = disc->op_ctx;
+  base_read = disc->op_read;
+  disc_sectors = disc->size / SECTOR_SIZE;
+  remap = calloc(disc_sectors, sizeof(uint16_t));
+  if (!remap) return -1;
+
+  // the first sectors hold the volume's creation date, a log over another disc is ignored
+  uint8_t sector[SECTOR_SIZE];
+  base_id = 2166136261u ^ disc->size; // FNV-1a
+  for (int i = 0; i < 4 && (unsigned int) i < disc_sectors; i++) {
+    if (base_read(base_ctx, sector, i * SECTOR_SIZE, SECTOR_SIZE) != 0) return -1;
+    for (int j = 0; j < SECTOR_SIZE; j++) base_id = (base_id ^ sector[j]) * 16777619u;
+  }
+
+  // valid headers in sequence order
+  static uint16_t order[SEG_COUNT];
+  int valid = 0;
+  for (int seg = 0; seg < SEG_COUNT; seg++) {
+    const seg_header_t *h = seg_header(seg);
+    int ours = h->magic == SEG_MAGIC && h->check == header_check(h);
+    erases[seg] = ours ? h->erases : 0;
+    if (!ours || h->base_id != base_id) continue;
+    int i = valid++;
+    for (; i > 0 && seg_header(order[i - 1])->seq > h->seq; i--) order[i] = order[i - 1];
+    order[i] = seg;
+  }
+  for (int k = 0; k < valid; k++) {
+    const seg_header_t *h = seg_header(order[k]);
+    for (int i = 0; i < SEG_SLOTS; i++) {
+      uint32_t s = h->sectors[i];
+      if (s >= disc_sectors) continue;
+      if (remap[s]) live[(remap[s] - 1) / SEG_SLOTS]--;
+      remap[s] = order[k] * SEG_SLOTS + i + 1;
+      live[order[k]]++;
+    }
+    next_seq = h->seq + 1;
+  }
+  update_wear_stats();
+
+  critical_section_init(&log_lock);
+  attached = 1;
+  disc->read_only = 0;
+  disc->op_ctx = NULL;
+  disc->op_read = log_read;
+  disc->op_write = log_write;
+  printf("flash log: %d KB, %d segments in use, read in %lu us\n", FLASH_LOG_KB, SEG_COUNT - free_segments(),
+         time_us_32() - start_us);
+  return 0;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "umac.h"
+
+// Writable in-flash disc: sectors written by the guest are appended to a log
+// in the last FLASH_LOG_KB of flash, the disc included in the firmware stays
+// as it is. Writes are staged in RAM and programmed by core 0.
+#ifndef FLASH_LOG_KB
+#define FLASH_LOG_KB 512
+#endif
+// Sectors waiting for core 0, the guest only waits when they are all in use
+#ifndef FLASH_LOG_STAGE_SECTORS
+#define FLASH_LOG_STAGE_SECTORS 14
+#endif
+
+typedef struct {
+  uint32_t commits;     // segments programmed
+  uint32_t moved;       // live sectors copied by garbage collection and wear levelling
+  uint32_t min_erases;  // wear spread over the log
+  uint32_t max_erases;
+} disc_flash_log_stats_t;
+
+extern disc_flash_log_stats_t disc_flash_log_stats;
+
+// Put the log over disc, made writable. Returns 0, or -1 (disc left read only)
+// when there is no room for the log after the firmware.
+int disc_flash_log_attach(disc_descr_t *disc);
+// Core 0: commit staged sectors once a segment is full or writes have stopped
+void disc_flash_log_service();
+// Core 0: commit everything staged, before a reset
+void disc_flash_log_sync();
@@ -0,0 +1,113 @@
+/* LZ codec for packed disc images:
+ *
+ * Sequences of a token (literal count in the high nibble, match length - 4
+ * in the low one, 15 meaning more length bytes follow), the literals, and a
+ * 16-bit little endian match offset. The last sequence has literals only.
+ * Greedy matching against a hash of the last position seen for each 4 bytes
+ * is plenty for the packer; decoding is a byte loop with no table. Free of
+ * SDK dependencies so that the packer can be built on the host.
+ */
+
+#include <string.h>
+
+#ifdef PICO
+#include "pico.h"
+#else
+#define __not_in_flash_func(f) f
+#endif
+
+#include "disc_lz.h"
+
+#define MIN_MATCH 4
+#define HASH_BITS 12
+#define MAX_OFFSET 65535
+
+static uint8_t *put_length(uint8_t *out, int extra) {
+  while (extra >= 255) {
+    *out++ = 255;
+    extra -= 255;
+  }
+  *out++ = extra;
+  return out;
+}
+
+static uint8_t *put_sequence(uint8_t *out, const uint8_t *literals, int lit, int offset, int match) {
+  int m = match ? match - MIN_MATCH : 0;
+  *out++ = (lit < 15 ? lit : 15) << 4 | (m < 15 ? m : 15);
+  if (lit >= 15) out = put_length(out, lit - 15);
+  memcpy(out, literals, lit);
+  out += lit;
+  if (!match) return out;
+  *out++ = offset & 0xff;
+  *out++ = offset >> 8;
+  if (m >= 15) out = put_length(out, m - 15);
+  return out;
+}
+
+static inline uint32_t hash4(const uint8_t *p) {
+  uint32_t v = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+int disc_lz_encode(const uint8_t *in, int n, uint8_t *out) {
+  int table[1 << HASH_BITS];
+  for (int i = 0; i < 1 << HASH_BITS; i++) table[i] = -1;
+
+  uint8_t *o = out;
+  int anchor = 0, i = 0;
+  while (i + MIN_MATCH <= n) {
+    uint32_t h = hash4(in + i);
+    int candidate = table[h];
+    table[h] = i;
+    if (candidate >= 0 && i - candidate <= MAX_OFFSET && !memcmp(in + candidate, in + i, MIN_MATCH)) {
+      int len = MIN_MATCH;
+      while (i + len < n && in[candidate + len] == in[i + len]) len++;
+      o = put_sequence(o, in + anchor, i - anchor, i - candidate, len);
+      i += len;
+      anchor = i;
+    } else {
+      i++;
+    }
+  }
+  if (anchor < n) o = put_sequence(o, in + anchor, n - anchor, 0, 0);
+  return o - out;
+}
+
+int __not_in_flash_func(disc_lz_decode)(const uint8_t *in, int in_len, uint8_t *out, int out_len) {
+  const uint8_t *in_end = in + in_len;
+  uint8_t *o = out, *end = out + out_len;
+  while (in < in_end) {
+    uint8_t token = *in++;
+    unsigned int lit = token >> 4;
+    if (lit == 15) {
+      uint8_t b;
+      do {
+        if (in >= in_end) return -1;
+        b = *in++;
+        lit += b;
+      } while (b == 255);
+    }
+    if (lit > (unsigned int) (end - o) || lit > (unsigned int) (in_end - in)) return -1;
+    memcpy(o, in, lit);
+    o += lit;
+    in += lit;
+    if (in == in_end) break; // literals only: last sequence
+
+    if (in_end - in < 2) return -1;
+    unsigned int offset = in[0] | in[1] << 8;
+    in += 2;
+    unsigned int len = (token & 15) + MIN_MATCH;
+    if ((token & 15) == 15) {
+      uint8_t b;
+      do {
+        if (in >= in_end) return -1;
+        b = *in++;
+        len += b;
+      } while (b == 255);
+    }
+    if (offset == 0 || offset > (unsigned int) (o - out) || len > (unsigned int) (end - o)) return -1;
+    const uint8_t *m = o - offset;
+    while (len--) *o++ = *m++; // may overlap, byte by byte on purpose
+  }
+  return o == end ? 0 : -1;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+// Packed disc images: a header, a table of block offsets, then each block
+// compressed on its own with an LZ4-style codec (or stored as is when it
+// does not shrink). Shared by the runtime and tools/disc-pack.c.
+
+#define DISC_LZ_MAGIC "UMCZ"
+#define DISC_LZ_BLOCK 4096
+
+typedef struct {
+  char magic[4];
+  uint32_t block_size;
+  uint32_t size;        // unpacked image size
+  uint32_t blocks;
+  // followed by uint32_t offsets[blocks + 1], from the start of the image
+} disc_lz_header_t;
+
+// Compress n bytes into out (which must hold n + n / 255 + 16 bytes), returns the packed length
+int disc_lz_encode(const uint8_t *in, int n, uint8_t *out);
+// Returns 0 when exactly out_len bytes were produced
+int disc_lz_decode(const uint8_t *in, int in_len, uint8_t *out, int out_len);
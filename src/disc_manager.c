@@ -0,0 +1,229 @@
+/* Disc manager:
+ *
+ * The root directory of the SD card is read once at boot into an index of
+ * disc images, so that drive 1 can be given its size without being opened:
+ * its ops open the picked image on the first guest access (core 1, with the
+ * SD card lock held by disc_async) and then forward to the SD ops.
+ *
+ * The picker (ctrl-alt-F6) takes over the LCD from core 0 and lists the
+ * index. While drive 1 has not been touched, an image of the same size is
+ * swapped in place; otherwise the choice is kept in watchdog scratch 1-2 and
+ * the machine reboots with pending writes synced. umac takes its drives once,
+ * in umac_init(), and has no insert or eject call: nothing can post the
+ * disk-inserted event the guest needs to mount another disc, or tell it that
+ * the mounted one is gone, so a disc the guest has read cannot be changed
+ * under it without a reboot.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "hardware/watchdog.h"
+#include "tf_card.h"
+#include "fatfs/ff.h"
+
+#include "disc_manager.h"
+#include "disc_sd.h"
+#include "disc_async.h"
+#include "keyboard.h"
+#include "lcd_3bit.h"
+#include "video.h"
+#include "log.h"
+
+#define DISC_INDEX_MAX 28 // one screen of picker
+#define DISC_NAME_MAX 40
+
+typedef struct {
+  char name[DISC_NAME_MAX];
+  uint32_t size;
+  const char *mode;   // how the image is accessed, known once opened
+} disc_entry_t;
+
+static disc_entry_t entries[DISC_INDEX_MAX];
+static int entry_count = 0;
+
+static disc_descr_t drive1;        // SD ops of the opened image
+static int drive1_entry = -1;      // picked image, -1 for none
+static volatile int drive1_opened = 0;
+
+static uint32_t disc_name_hash(const char *name)
+{
+  uint32_t h = 2166136261u; // FNV-1a
+  while (*name) h = (h ^ (uint8_t)*name++) * 16777619u;
+  return h ? h : 1; // 0 stands for "no disc"
+}
+
+static int disc_is_image(const char *name)
+{
+  const char *ext = strrchr(name, '.');
+#if USE_SCSI
+  if (ext == name + 3 && (name[0] | 0x20) == 'h' && (name[1] | 0x20) == 'd' && name[2] >= '0' && name[2] <= '9')
+    return 0; // SCSI disks
+#endif
+  return ext && (strcasecmp(ext, ".img") == 0 || strcasecmp(ext, ".dsk") == 0);
+}
+
+int disc_manager_scan(const char *boot_name)
+{
+  static DIR dir;
+  static FILINFO fno;
+  entry_count = 0;
+  if (f_opendir(&dir, "/") != FR_OK) return 0;
+  while (entry_count < DISC_INDEX_MAX && f_readdir(&dir, &fno) == FR_OK && fno.fname[0]) {
+    if (fno.fattrib & (AM_DIR | AM_HID | AM_SYS)) continue;
+    if (!disc_is_image(fno.fname) || strcasecmp(fno.fname, boot_name) == 0) continue;
+    if (strlen(fno.fname) >= DISC_NAME_MAX) continue;
+    disc_entry_t *e = &entries[entry_count++];
+    strcpy(e->name, fno.fname);
+    e->size = fno.fsize;
+    e->mode = NULL;
+  }
+  f_closedir(&dir);
+  return entry_count;
+}
+
+static int disc_find(const char *name)
+{
+  for (int i = 0; i < entry_count; i++) {
+    if (strcasecmp(entries[i].name, name) == 0) return i;
+  }
+  return -1;
+}
+
+static int disc_lazy_open()
+{
+  disc_entry_t *e = &entries[drive1_entry];
+  int result = disc_sd_open(&drive1, 1, e->name, 0);
+  if (result != FR_OK) {
+    LOG_ERROR("disc: opening %s failed (%d)\n", e->name, result);
+    return -1;
+  }
+  e->mode = disc_sd_mode(1);
+  drive1_opened = 1;
+  LOG_INFO("disc: %s mounted, %s\n", e->name, e->mode);
+  return 0;
+}
+
+static int disc_lazy_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len)
+{
+  if (!drive1_opened && disc_lazy_open() != 0) return -1;
+  return drive1.op_read(drive1.op_ctx, data, offset, len);
+}
+
+static int disc_lazy_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len)
+{
+  if (!drive1_opened && disc_lazy_open() != 0) return -1;
+  return drive1.op_write(drive1.op_ctx, data, offset, len);
+}
+
+int disc_manager_attach(disc_descr_t *disc)
+{
+  drive1_entry = disc_find("umac1.img");
+  if (watchdog_hw->scratch[1] == DISC_PICK_MAGIC) {
+    drive1_entry = -1;
+    for (int i = 0; i < entry_count; i++) {
+      if (disc_name_hash(entries[i].name) == watchdog_hw->scratch[2]) drive1_entry = i;
+    }
+    watchdog_hw->scratch[1] = 0;
+  }
+  if (drive1_entry < 0) return 0;
+
+  disc->base = 0;
+  disc->read_only = 0;
+  disc->size = entries[drive1_entry].size;
+  disc->op_ctx = NULL;
+  disc->op_read = disc_lazy_read;
+  disc->op_write = disc_lazy_write;
+  printf("drive 1: %s (%lu bytes), opened on first access\n", entries[drive1_entry].name, entries[drive1_entry].size);
+  return 1;
+}
+
+// Picker
+
+static volatile int picker_requested = 0;
+static int picker_open = 0;
+static int picker_sel;
+
+void disc_picker_request()
+{
+  picker_requested = 1;
+}
+
+static void disc_picker_draw()
+{
+  lcd_fill(0, 0, 0, WIDTH, HEIGHT);
+  lcd_printf(0, 0, 0x6, 0, "drive 1: up/down, enter to insert, esc");
+  for (int i = -1; i < entry_count; i++) {
+    const char *name = i < 0 ? "(no disc)" : entries[i].name;
+    int selected = i == picker_sel;
+    u8 fg = selected ? 0 : 0x7;
+    u8 bg = selected ? 0x7 : 0;
+    // 40 columns: the name is cut to what is left by the mark, the size and the mode
+    if (i < 0) {
+      lcd_printf(0, 20 + 10 * (i + 1), fg, bg, "%c %-38.38s", i == drive1_entry ? '*' : ' ', name);
+    } else {
+      unsigned long kb = entries[i].size / 1024;
+      lcd_printf(0, 20 + 10 * (i + 1), fg, bg, "%c %-28.28s %4lu%c %-3s", i == drive1_entry ? '*' : ' ', name,
+                 kb < 10000 ? kb : kb / 1024, kb < 10000 ? 'K' : 'M',
+                 entries[i].mode && entries[i].mode[0] == 'c' ? "raw" : "");
+    }
+  }
+}
+
+static void disc_picker_apply(int sel)
+{
+  if (sel == drive1_entry) return;
+
+  // nothing read yet and the guest sees the same size: swap under the SD lock
+  disc_async_lock();
+  int swapped = !drive1_opened && drive1_entry >= 0 && sel >= 0 && entries[sel].size == entries[drive1_entry].size;
+  if (swapped) drive1_entry = sel;
+  disc_async_unlock();
+  if (swapped) {
+    LOG_INFO("disc: %s inserted\n", entries[sel].name);
+    return;
+  }
+
+  lcd_printf(0, HEIGHT - 10, 0x6, 0, "rebooting with %.25s", sel < 0 ? "no disc" : entries[sel].name);
+  printf("rebooting to insert %s\n", sel < 0 ? "no disc" : entries[sel].name);
+  disc_sync();
+  watchdog_hw->scratch[2] = sel < 0 ? 0 : disc_name_hash(entries[sel].name);
+  watchdog_hw->scratch[1] = DISC_PICK_MAGIC;
+  watchdog_reboot(0, 0, 0);
+  watchdog_enable(0, 1);
+  while (1);
+}
+
+void disc_picker_task()
+{
+  if (!picker_open) {
+    if (!picker_requested) return;
+    picker_requested = 0;
+    picker_open = 1;
+    picker_sel = drive1_entry;
+    video_suspend();
+    disc_picker_draw();
+  }
+
+  input_event_t event = keyboard_poll();
+  if (event.state != KEY_STATE_PRESSED || event.modifiers != 0) return;
+  switch (event.code) {
+    case KEY_UP:
+      if (picker_sel > -1) picker_sel--;
+      break;
+    case KEY_DOWN:
+      if (picker_sel < entry_count - 1) picker_sel++;
+      break;
+    case KEY_ENTER:
+      disc_picker_apply(picker_sel);
+      // fall through
+    case KEY_ESCAPE:
+      picker_open = 0;
+      video_resume();
+      return;
+    default:
+      return;
+  }
+  disc_picker_draw();
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "umac.h"
+
+// Disc images found in the root of the SD card. Drive 0 is opened at boot,
+// drive 1 on the first guest access, and can be swapped with the picker.
+
+// Set in watchdog scratch 1 (with the name hash in scratch 2) to pick the drive 1
+// image across a reboot
+#define DISC_PICK_MAGIC 0x50494b31 // "PIK1"
+
+// Read the root directory into the index, skipping boot_name. Returns the number of images.
+int disc_manager_scan(const char *boot_name);
+// Give drive 1 the picked image (umac1.img by default) without opening it.
+// Returns 0 when there is nothing to mount.
+int disc_manager_attach(disc_descr_t *disc);
+// Open the picker on the LCD, from the keyboard chord
+void disc_picker_request();
+// Core 0: runs the picker when it is open, to be called from the main loop
+void disc_picker_task();
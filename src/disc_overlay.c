@@ -0,0 +1,158 @@
+/* Copy-on-write disc overlay:
+ *
+ * An index holding a 16-bit record number per sector of the base image (0 when
+ * the sector was never written) is rebuilt from the delta file at mount. Reads
+ * fetch the range from the base image and then patch in the sectors found in
+ * the index, so unmodified sectors only cost a table lookup. A sector written
+ * again overwrites its record in place, new ones are appended.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hardware/watchdog.h"
+#include "tf_card.h"
+#include "fatfs/ff.h"
+
+#include "disc_overlay.h"
+#include "log.h"
+
+#define SECTOR_SIZE 512
+#define RECORD_SIZE (4 + SECTOR_SIZE)
+#define MAX_RECORDS 0xffff
+
+typedef int (*disc_op_t)(void *ctx, uint8_t *data, unsigned int offset, unsigned int len);
+
+typedef struct {
+  void *ctx;          // base image ops
+  disc_op_t read;
+  FIL delta;
+  uint16_t *index;    // record number + 1 for each sector
+  uint32_t sectors;
+  uint32_t records;
+} overlay_t;
+
+static overlay_t overlays[DISC_NUM_DRIVES];
+static uint8_t sector_buf[SECTOR_SIZE] __attribute__((aligned(4)));
+
+static int read_record(overlay_t *o, uint32_t record, uint8_t *data) {
+  unsigned int did_read = 0;
+  if (f_lseek(&o->delta, (FSIZE_t) record * RECORD_SIZE + 4) != FR_OK ||
+      f_read(&o->delta, data, SECTOR_SIZE, &did_read) != FR_OK || did_read != SECTOR_SIZE) {
+    LOG_ERROR("overlay: reading record %lu failed\n", record);
+    return -1;
+  }
+  return 0;
+}
+
+static int write_record(overlay_t *o, uint32_t sector, const uint8_t *data) {
+  uint32_t record;
+  if (o->index[sector]) {
+    record = o->index[sector] - 1;
+  } else {
+    if (o->records == MAX_RECORDS) {
+      LOG_ERROR("overlay: delta full, sector %lu not written\n", sector);
+      return -1;
+    }
+    record = o->records;
+  }
+  unsigned int did_write = 0, did_write2 = 0;
+  if (f_lseek(&o->delta, (FSIZE_t) record * RECORD_SIZE) != FR_OK ||
+      f_write(&o->delta, &sector, 4, &did_write) != FR_OK ||
+      f_write(&o->delta, data, SECTOR_SIZE, &did_write2) != FR_OK ||
+      did_write + did_write2 != RECORD_SIZE || f_sync(&o->delta) != FR_OK) {
+    LOG_ERROR("overlay: writing record %lu failed\n", record);
+    return -1;
+  }
+  if (!o->index[sector]) {
+    o->index[sector] = record + 1;
+    o->records++;
+  }
+  return 0;
+}
+
+static int overlay_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  overlay_t *o = ctx;
+  int r = o->read(o->ctx, data, offset, len);
+  if (r != 0) return r;
+  for (uint32_t sector = offset / SECTOR_SIZE; sector * SECTOR_SIZE < offset + len; sector++) {
+    if (!o->index[sector]) continue;
+    unsigned int start = sector * SECTOR_SIZE > offset ? sector * SECTOR_SIZE : offset;
+    unsigned int end = (sector + 1) * SECTOR_SIZE < offset + len ? (sector + 1) * SECTOR_SIZE : offset + len;
+    if (start == sector * SECTOR_SIZE && end - start == SECTOR_SIZE) {
+      r = read_record(o, o->index[sector] - 1, data + start - offset);
+    } else {
+      r = read_record(o, o->index[sector] - 1, sector_buf);
+      memcpy(data + start - offset, sector_buf + start - sector * SECTOR_SIZE, end - start);
+    }
+    if (r != 0) return r;
+  }
+  return 0;
+}
+
+static int overlay_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  overlay_t *o = ctx;
+  for (uint32_t sector = offset / SECTOR_SIZE; sector * SECTOR_SIZE < offset + len; sector++) {
+    unsigned int start = sector * SECTOR_SIZE > offset ? sector * SECTOR_SIZE : offset;
+    unsigned int end = (sector + 1) * SECTOR_SIZE < offset + len ? (sector + 1) * SECTOR_SIZE : offset + len;
+    int r;
+    if (start == sector * SECTOR_SIZE && end - start == SECTOR_SIZE) {
+      r = write_record(o, sector, data + start - offset);
+    } else {
+      // partial sector: merge into its current contents
+      r = overlay_read(o, sector_buf, sector * SECTOR_SIZE, SECTOR_SIZE);
+      if (r == 0) {
+        memcpy(sector_buf + start - sector * SECTOR_SIZE, data + start - offset, end - start);
+        r = write_record(o, sector, sector_buf);
+      }
+    }
+    if (r != 0) return r;
+  }
+  return 0;
+}
+
+int disc_overlay_attach(disc_descr_t *disc, int drive, const char *delta_name) {
+  overlay_t *o = &overlays[drive];
+  o->sectors = (disc->size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+  o->index = calloc(o->sectors, sizeof(uint16_t));
+  if (!o->index) return FR_NOT_ENOUGH_CORE;
+
+  FRESULT result = f_open(&o->delta, delta_name, FA_OPEN_ALWAYS | FA_READ | FA_WRITE);
+  if (result != FR_OK) {
+    free(o->index);
+    return result;
+  }
+
+  if (watchdog_hw->scratch[0] == DISC_OVERLAY_RESET_MAGIC) {
+    // reset requested before the reboot: back to the pristine base image
+    f_lseek(&o->delta, 0);
+    f_truncate(&o->delta);
+    f_sync(&o->delta);
+  }
+
+  // rebuild the index, a torn record at the end (power loss) is ignored
+  o->records = f_size(&o->delta) / RECORD_SIZE;
+  if (o->records > MAX_RECORDS) o->records = MAX_RECORDS;
+  for (uint32_t record = 0; record < o->records; record++) {
+    uint32_t sector;
+    unsigned int did_read = 0;
+    f_lseek(&o->delta, (FSIZE_t) record * RECORD_SIZE);
+    if (f_read(&o->delta, &sector, 4, &did_read) != FR_OK || did_read != 4) {
+      o->records = record;
+      break;
+    }
+    if (sector < o->sectors) o->index[sector] = record + 1;
+  }
+
+  o->ctx = disc->op_ctx;
+  o->read = disc->op_read;
+  disc->read_only = 0;
+  disc->op_ctx = o;
+  disc->op_read = overlay_read;
+  disc->op_write = overlay_write;
+  return FR_OK;
+}
+
+unsigned int disc_overlay_sectors(int drive) {
+  return overlays[drive].records;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "umac.h"
+
+// Copy-on-write overlay: the base image is left untouched and sector writes go
+// to a delta file, made of [u32 sector][512 bytes of data] records.
+
+// Set in watchdog scratch 0 before a reboot to have the delta emptied at boot
+#define DISC_OVERLAY_RESET_MAGIC 0x4f564c52 // "OVLR"
+
+// Put disc (opened read-only) under the delta file delta_name, created if
+// missing. Returns a FatFs FRESULT, the disc is left as it was on failure.
+int disc_overlay_attach(disc_descr_t *disc, int drive, const char *delta_name);
+// Number of sectors held by the delta of a drive
+unsigned int disc_overlay_sectors(int drive);
@@ -0,0 +1,84 @@
+/* Packed in-flash disc:
+ *
+ * Blocks are unpacked from flash into a few block buffers, the least recently
+ * used one being reused, so that runs of sector reads within a block only
+ * unpack it once.
+ */
+
+#include <string.h>
+
+#ifdef PICO
+#include "pico.h"
+#else
+#define __not_in_flash_func(f) f
+#endif
+
+#include "disc_packed.h"
+#include "disc_lz.h"
+#include "log.h"
+
+typedef struct {
+  int32_t block;      // -1 when empty
+  uint32_t stamp;
+  uint8_t data[DISC_LZ_BLOCK] __attribute__((aligned(4)));
+} block_buf_t;
+
+static const uint8_t *packed;
+static const disc_lz_header_t *header;
+static const uint32_t *offsets;
+static block_buf_t buffers[DISC_PACKED_CACHE_BLOCKS];
+static uint32_t lru_clock = 0;
+
+static const uint8_t *__not_in_flash_func(get_block)(uint32_t block) {
+  block_buf_t *victim = &buffers[0];
+  for (int i = 0; i < DISC_PACKED_CACHE_BLOCKS; i++) {
+    if (buffers[i].block == (int32_t) block) {
+      buffers[i].stamp = ++lru_clock;
+      return buffers[i].data;
+    }
+    if (buffers[i].stamp < victim->stamp) victim = &buffers[i];
+  }
+
+  uint32_t len = offsets[block + 1] - offsets[block];
+  if (len == DISC_LZ_BLOCK) {
+    memcpy(victim->data, packed + offsets[block], DISC_LZ_BLOCK);
+  } else if (disc_lz_decode(packed + offsets[block], len, victim->data, DISC_LZ_BLOCK) != 0) {
+    LOG_ERROR("disc: packed block %lu is corrupt\n", block);
+    victim->block = -1;
+    return NULL;
+  }
+  victim->block = block;
+  victim->stamp = ++lru_clock;
+  return victim->data;
+}
+
+static int __not_in_flash_func(disc_packed_read)(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  (void) ctx;
+  if (offset + len > header->size) return -1;
+  while (len > 0) {
+    const uint8_t *block = get_block(offset / DISC_LZ_BLOCK);
+    if (!block) return -1;
+    unsigned int start = offset % DISC_LZ_BLOCK;
+    unsigned int n = DISC_LZ_BLOCK - start < len ? DISC_LZ_BLOCK - start : len;
+    memcpy(data, block + start, n);
+    data += n;
+    offset += n;
+    len -= n;
+  }
+  return 0;
+}
+
+int disc_packed_attach(disc_descr_t *disc, const uint8_t *image) {
+  header = (const disc_lz_header_t *) image;
+  if (memcmp(header->magic, DISC_LZ_MAGIC, 4) || header->block_size != DISC_LZ_BLOCK) return -1;
+  packed = image;
+  offsets = (const uint32_t *) (image + sizeof(disc_lz_header_t));
+  for (int i = 0; i < DISC_PACKED_CACHE_BLOCKS; i++) buffers[i].block = -1;
+
+  disc->base = 0; // Means use R/W ops
+  disc->read_only = 1;
+  disc->size = header->size;
+  disc->op_ctx = NULL;
+  disc->op_read = disc_packed_read;
+  return 0;
+}
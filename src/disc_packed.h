@@ -0,0 +1,11 @@
+#pragma once
+
+#include "umac.h"
+
+// In-flash disc packed by tools/disc-pack.c, unpacked block by block on read
+#ifndef DISC_PACKED_CACHE_BLOCKS
+#define DISC_PACKED_CACHE_BLOCKS 2
+#endif
+
+// Serve disc (read only) from the packed image, returns 0 or -1 if it is not one
+int disc_packed_attach(disc_descr_t *disc, const uint8_t *image);
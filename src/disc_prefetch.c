@@ -0,0 +1,191 @@
+/* Sequential read-ahead:
+ *
+ * Each drive has a stream detector: a read starting where the previous one
+ * ended asks core 0 for the window of sectors that follows, which it reads
+ * into the drive's buffer between frames. Core 1 copies the sectors it finds
+ * there instead of going to the card. A buffer read to the end doubles the
+ * window, one dropped with unread sectors halves it.
+ *
+ * Buffer ownership goes with the state: core 0 only touches the data while
+ * FILLING, core 1 only reads it while READY. A write overlapping a buffer
+ * drops it; one being filled is marked CANCELLED and discarded by core 0.
+ * Builds on the host as well, with threads for the cores.
+ */
+
+#include <string.h>
+
+#ifdef PICO
+#include "pico/critical_section.h"
+#include "hardware/sync.h"
+#else
+// host builds (tools/disc-prefetch-test.c): core 0 and core 1 are threads
+#include <pthread.h>
+#include <sched.h>
+typedef pthread_mutex_t critical_section_t;
+#define critical_section_init(lock) pthread_mutex_init(lock, NULL)
+#define critical_section_enter_blocking(lock) pthread_mutex_lock(lock)
+#define critical_section_exit(lock) pthread_mutex_unlock(lock)
+#define __wfe() sched_yield()
+#define __sev() do { } while (0)
+#endif
+
+#include "disc_prefetch.h"
+#include "log.h"
+
+#define SECTOR_SIZE 512
+#define WINDOW_MIN 2
+
+disc_prefetch_stats_t disc_prefetch_stats;
+
+#if DISC_PREFETCH_SECTORS > 0
+
+typedef int (*disc_op_t)(void *ctx, uint8_t *data, unsigned int offset, unsigned int len);
+
+enum { PF_IDLE, PF_WANTED, PF_FILLING, PF_CANCELLED, PF_READY };
+
+typedef struct {
+  void *ctx;
+  disc_op_t read;
+  disc_op_t write;
+  uint32_t sectors;   // size of the disc
+  uint32_t next;      // sector following the last read
+  uint32_t window;
+  volatile uint8_t state;
+  uint32_t start;     // buffered (or wanted) sectors
+  uint32_t count;
+  uint32_t used;      // buffered sectors read so far, from the start
+  uint8_t data[DISC_PREFETCH_SECTORS * SECTOR_SIZE] __attribute__((aligned(4)));
+} stream_t;
+
+static stream_t streams[DISC_NUM_DRIVES];
+static critical_section_t pf_lock;
+static int attached = 0;
+
+// let go of the buffer and adapt the window to how much of it was used, with pf_lock held
+static void drop(stream_t *s) {
+  if (s->state == PF_READY) {
+    if (s->used == s->count) {
+      s->window = s->window * 2 < DISC_PREFETCH_SECTORS ? s->window * 2 : DISC_PREFETCH_SECTORS;
+    } else {
+      disc_prefetch_stats.wasted += s->count - s->used;
+      if (s->window > WINDOW_MIN) s->window /= 2;
+    }
+  }
+  s->state = s->state == PF_FILLING ? PF_CANCELLED : PF_IDLE;
+}
+
+static int prefetch_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  stream_t *s = ctx;
+  if ((offset | len) % SECTOR_SIZE) return s->read(s->ctx, data, offset, len);
+
+  uint32_t first = offset / SECTOR_SIZE;
+  uint32_t n = len / SECTOR_SIZE;
+  int sequential = first == s->next;
+  s->next = first + n;
+
+  critical_section_enter_blocking(&pf_lock);
+  // wait for sectors on their way, rather than reading them twice
+  while (s->state == PF_FILLING && first >= s->start && first < s->start + s->count) {
+    critical_section_exit(&pf_lock);
+    __wfe();
+    critical_section_enter_blocking(&pf_lock);
+  }
+  // a fetch not started yet moves past what is read now
+  if (s->state == PF_WANTED) {
+    s->start = first + n;
+    if (!sequential || s->start >= s->sectors) s->state = PF_IDLE;
+    else if (s->count > s->sectors - s->start) s->count = s->sectors - s->start;
+  }
+  uint32_t k = 0;
+  if (s->state == PF_READY && first >= s->start && first < s->start + s->count)
+    k = s->start + s->count - first < n ? s->start + s->count - first : n;
+  critical_section_exit(&pf_lock);
+
+  if (k) {
+    memcpy(data, s->data + (first - s->start) * SECTOR_SIZE, k * SECTOR_SIZE);
+    if (first + k - s->start > s->used) s->used = first + k - s->start;
+    disc_prefetch_stats.hits += k;
+  }
+  if (k < n) {
+    int r = s->read(s->ctx, data + k * SECTOR_SIZE, (first + k) * SECTOR_SIZE, (n - k) * SECTOR_SIZE);
+    if (r != 0) return r;
+  }
+
+  // ask for what follows a sequential run once the buffer has been used up
+  critical_section_enter_blocking(&pf_lock);
+  if (sequential && s->state == PF_READY && (s->next >= s->start + s->count || s->next < s->start)) drop(s);
+  if (sequential && s->state == PF_IDLE && s->next < s->sectors) {
+    s->start = s->next;
+    s->count = s->sectors - s->next < s->window ? s->sectors - s->next : s->window;
+    s->state = PF_WANTED;
+  }
+  critical_section_exit(&pf_lock);
+  return 0;
+}
+
+static int prefetch_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  stream_t *s = ctx;
+  uint32_t first = offset / SECTOR_SIZE;
+  uint32_t last = (offset + len - 1) / SECTOR_SIZE;
+  critical_section_enter_blocking(&pf_lock);
+  if (s->state != PF_IDLE && first < s->start + s->count && last >= s->start) drop(s);
+  critical_section_exit(&pf_lock);
+  s->next = last + 1;
+  return s->write(s->ctx, data, offset, len);
+}
+
+void disc_prefetch_attach(disc_descr_t *disc, int drive) {
+  if (!attached) {
+    critical_section_init(&pf_lock);
+    attached = 1;
+  }
+  stream_t *s = &streams[drive];
+  s->ctx = disc->op_ctx;
+  s->read = disc->op_read;
+  s->write = disc->op_write;
+  s->sectors = disc->size / SECTOR_SIZE;
+  s->next = ~0u;
+  s->window = WINDOW_MIN;
+  s->state = PF_IDLE;
+  disc->op_ctx = s;
+  disc->op_read = prefetch_read;
+  if (!disc->read_only) disc->op_write = prefetch_write;
+}
+
+void disc_prefetch_service() {
+  if (!attached) return;
+  for (int drive = 0; drive < DISC_NUM_DRIVES; drive++) {
+    stream_t *s = &streams[drive];
+    critical_section_enter_blocking(&pf_lock);
+    int wanted = s->state == PF_WANTED;
+    if (wanted) s->state = PF_FILLING;
+    uint32_t start = s->start, count = s->count;
+    critical_section_exit(&pf_lock);
+    if (!wanted) continue;
+
+    int r = s->read(s->ctx, s->data, start * SECTOR_SIZE, count * SECTOR_SIZE);
+    critical_section_enter_blocking(&pf_lock);
+    if (s->state == PF_FILLING && r == 0) {
+      s->used = 0;
+      s->state = PF_READY;
+      disc_prefetch_stats.fetched += count;
+    } else {
+      s->state = PF_IDLE;
+    }
+    critical_section_exit(&pf_lock);
+    __sev();
+    LOG_DEBUG("disc: drive %d prefetched %lu sectors at %lu\n", drive, count, start);
+  }
+}
+
+#else
+
+void disc_prefetch_attach(disc_descr_t *disc, int drive) {
+  (void) disc;
+  (void) drive;
+}
+
+void disc_prefetch_service() {
+}
+
+#endif
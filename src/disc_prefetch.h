@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "umac.h"
+
+// Sequential read-ahead: once a drive is read in order, core 0 fetches the
+// sectors that follow into a per-drive buffer of up to DISC_PREFETCH_SECTORS
+// (0 disables it), the window growing while prefetched data gets used.
+#ifndef DISC_PREFETCH_SECTORS
+#define DISC_PREFETCH_SECTORS 8
+#endif
+
+typedef struct {
+  uint32_t hits;      // sectors read by the guest from a prefetch buffer
+  uint32_t fetched;   // sectors prefetched
+  uint32_t wasted;    // prefetched sectors dropped without being read
+} disc_prefetch_stats_t;
+
+extern disc_prefetch_stats_t disc_prefetch_stats;
+
+// Route a drive's ops through the prefetcher, writes invalidate what they overlap
+void disc_prefetch_attach(disc_descr_t *disc, int drive);
+// Core 0: fetch the sectors asked for by core 1, to be called from the main loop
+void disc_prefetch_service();
@@ -0,0 +1,177 @@
+/* SD card disc images:
+ *
+ * Opening an image walks its cluster chain once and keeps it as a short list
+ * of extents, runs of consecutive clusters. Guest offsets then translate to
+ * card sectors without touching the FAT, and transfers go to the
+ * disk_read()/disk_write() layer as multi-block commands, split at extent
+ * ends, with a bounce buffer for partial sectors. Only images in more than
+ * SD_EXTENTS pieces go through f_lseek() and f_read()/f_write(), which follow
+ * the FAT at each seek (FatFs' own fast seek is off in pico_fatfs' ffconf.h).
+ */
+
+#include <string.h>
+
+#include "tf_card.h"
+#include "fatfs/ff.h"
+#include "fatfs/diskio.h"
+
+#include "disc_sd.h"
+#include "log.h"
+
+#define SECTOR_SIZE FF_MAX_SS
+#define SD_EXTENTS 16
+
+typedef struct {
+  DWORD clusters;     // clusters of the image up to the end of this run
+  LBA_t sector;       // card sector of the run's first cluster
+} sd_extent_t;
+
+typedef struct {
+  FIL fil;
+  int extents;        // runs mapped, 0 if the image is too fragmented
+  sd_extent_t extent[SD_EXTENTS];
+} disc_sd_t;
+
+static disc_sd_t images[DISC_SD_SLOTS];
+static uint8_t bounce[SECTOR_SIZE] __attribute__((aligned(4)));
+
+static int disc_sd_sectors(BYTE pdrv, LBA_t sector, unsigned int skip, uint8_t *data, unsigned int len, int write)
+{
+  while (len > 0) {
+    if (skip == 0 && len >= SECTOR_SIZE) {
+      UINT count = len / SECTOR_SIZE;
+      DRESULT dr = write ? disk_write(pdrv, data, sector, count) : disk_read(pdrv, data, sector, count);
+      if (dr != RES_OK) {
+        LOG_ERROR("disc: raw %s of %u sectors at %lu returned %d\n", write ? "write" : "read", count, sector, dr);
+        return -1;
+      }
+      sector += count;
+      data += count * SECTOR_SIZE;
+      len -= count * SECTOR_SIZE;
+    } else {
+      // partial sector, read-modify-write through the bounce buffer
+      unsigned int n = SECTOR_SIZE - skip < len ? SECTOR_SIZE - skip : len;
+      if (disk_read(pdrv, bounce, sector, 1) != RES_OK) return -1;
+      if (write) {
+        memcpy(bounce + skip, data, n);
+        if (disk_write(pdrv, bounce, sector, 1) != RES_OK) return -1;
+      } else {
+        memcpy(data, bounce + skip, n);
+      }
+      sector++;
+      data += n;
+      len -= n;
+      skip = 0;
+    }
+  }
+  return 0;
+}
+
+static int disc_sd_raw(disc_sd_t *img, uint8_t *data, unsigned int offset, unsigned int len, int write)
+{
+  FATFS *fs = img->fil.obj.fs;
+  unsigned int cluster_bytes = fs->csize * SECTOR_SIZE;
+  DWORD start = 0;
+  for (int i = 0; i < img->extents && len > 0; start = img->extent[i++].clusters) {
+    unsigned int end = img->extent[i].clusters * cluster_bytes;
+    if (offset >= end) continue;
+    unsigned int n = end - offset < len ? end - offset : len;
+    unsigned int in_run = offset - start * cluster_bytes;
+    if (disc_sd_sectors(fs->pdrv, img->extent[i].sector + in_run / SECTOR_SIZE, in_run % SECTOR_SIZE,
+                        data, n, write))
+      return -1;
+    offset += n;
+    data += n;
+    len -= n;
+  }
+  return len ? -1 : 0;
+}
+
+static int disc_do_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len)
+{
+  LOG_DEBUG("sd read %p %d %d\n", data, offset, len);
+  disc_sd_t *img = (disc_sd_t *)ctx;
+  if (img->extents) return disc_sd_raw(img, data, offset, len, 0);
+  FIL *fp = &img->fil;
+  f_lseek(fp, offset);
+  unsigned int did_read = 0;
+  FRESULT fr = f_read(fp, data, len, &did_read);
+  if (fr != FR_OK || len != did_read) {
+    LOG_ERROR("disc: f_read returned %d, read %u (of %u)\n", fr, did_read, len);
+    return -1;
+  }
+  return 0;
+}
+
+static int disc_do_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len)
+{
+  LOG_DEBUG("sd write %p %d %d\n", data, offset, len);
+  disc_sd_t *img = (disc_sd_t *)ctx;
+  if (img->extents) return disc_sd_raw(img, data, offset, len, 1);
+  FIL *fp = &img->fil;
+  f_lseek(fp, offset);
+  unsigned int did_write = 0;
+  FRESULT fr = f_write(fp, data, len, &did_write);
+  if (fr != FR_OK || len != did_write) {
+    LOG_ERROR("disc: f_write returned %d, read %u (of %u)\n", fr, did_write, len);
+    return -1;
+  }
+  return 0;
+}
+
+static LBA_t disc_sd_cluster_sector(FATFS *fs, DWORD cluster)
+{
+  return fs->database + (LBA_t)fs->csize * (cluster - 2);
+}
+
+// fill in the extents of the image, returns how many, 0 if more than SD_EXTENTS
+static int disc_sd_map(disc_sd_t *img)
+{
+  FIL *fp = &img->fil;
+  FATFS *fs = fp->obj.fs;
+  FSIZE_t size = f_size(fp);
+  FSIZE_t cluster_bytes = (FSIZE_t)fs->csize * SECTOR_SIZE;
+  DWORD previous = fp->obj.sclust, clusters = 1;
+  int n = 0;
+  if (previous < 2) return 0;
+  img->extent[0].sector = disc_sd_cluster_sector(fs, previous);
+
+  // seeking one byte into each cluster makes FatFs follow the chain, once in all
+  for (FSIZE_t ofs = cluster_bytes; ofs < size; ofs += cluster_bytes, clusters++) {
+    if (f_lseek(fp, ofs + 1) != FR_OK) return 0;
+    if (fp->clust != previous + 1) {
+      img->extent[n++].clusters = clusters;
+      if (n == SD_EXTENTS) return 0;
+      img->extent[n].sector = disc_sd_cluster_sector(fs, fp->clust);
+    }
+    previous = fp->clust;
+  }
+  img->extent[n++].clusters = clusters;
+  f_lseek(fp, 0);
+  return n;
+}
+
+int disc_sd_open(disc_descr_t *disc, int drive, const char *name, int read_only)
+{
+  disc_sd_t *img = &images[drive];
+  FRESULT result = f_open(&img->fil, name, FA_OPEN_EXISTING | FA_READ | (read_only ? 0 : FA_WRITE));
+  if (result != FR_OK) return result;
+
+  img->extents = disc_sd_map(img);
+
+  disc->base = 0; // Means use R/W ops
+  disc->read_only = read_only;
+  disc->size = f_size(&img->fil);
+  disc->op_ctx = img;
+  disc->op_read = disc_do_read;
+  disc->op_write = read_only ? NULL : disc_do_write;
+  return FR_OK;
+}
+
+const char *disc_sd_mode(int drive)
+{
+  disc_sd_t *img = &images[drive];
+  if (img->extents == 1) return "contiguous, raw sectors";
+  if (img->extents) return "fragmented, raw sectors";
+  return "fragmented, FatFs";
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "umac.h"
+
+// Disc images on the SD card. Images in up to 16 runs of clusters are accessed
+// with raw multi-block reads and writes straight from the card, others through
+// FatFs.
+
+// Drives 0 to DISC_NUM_DRIVES - 1 are the floppies, the SCSI disks come after
+#if USE_SCSI
+#include "scsi.h"
+#define DISC_SD_SLOTS (DISC_NUM_DRIVES + SCSI_NUM_TARGETS)
+#else
+#define DISC_SD_SLOTS DISC_NUM_DRIVES
+#endif
+
+// Open name for drive and fill in disc with the SD ops, returns a FatFs FRESULT
+int disc_sd_open(disc_descr_t *disc, int drive, const char *name, int read_only);
+// How a drive opened by disc_sd_open() is accessed, for the boot messages
+const char *disc_sd_mode(int drive);
@@ -0,0 +1,121 @@
+/* Speed governor:
+ *
+ * Runs as a scheduler event every quarter of a frame of emulated time and,
+ * when throttling, sleeps until wall-clock time catches up with the cycles
+ * executed. The clock is only read there, never in the hot loop. Disc
+ * accesses are noticed by a layer on top of each drive's ops, which only
+ * the emulator calls, so the I/O window is kept on core 1 alone.
+ */
+
+#include "pico/time.h"
+
+#include "sched.h"
+#if USE_SD
+#include "disc_sd.h"
+#endif
+#include "governor.h"
+#include "log.h"
+#include "profile.h"
+
+#define GOVERNOR_TICK_CYCLES (SCHED_VSYNC_CYCLES / 4)
+#define GOVERNOR_IO_CYCLES (SCHED_CPU_HZ / 4) // unthrottled time after a disc access
+#define GOVERNOR_MAX_LAG_US 100000            // give up catching up when that far behind
+
+static const char* mode_names[GOVERNOR_MODES] = {"accurate", "max", "turbo on I/O"};
+
+static volatile governor_mode_t mode = GOVERNOR_TURBO_IO;
+static volatile int report = 0;
+
+static int throttled = 0;
+static uint64_t base_us, base_cycles;   // wall clock and emulated time of the last sync
+static uint64_t window_us = 0, window_cycles = 0;
+static int speed = 0;
+
+static int io_seen = 0;                 // the boot ROM runs unthrottled until the first access
+static uint64_t io_until = 0;
+
+static void governor_tick() {
+  uint64_t now = time_us_64();
+  int throttle = mode == GOVERNOR_ACCURATE || (mode == GOVERNOR_TURBO_IO && io_seen && sched_now >= io_until);
+
+  if (throttle) {
+    if (!throttled) {
+      base_us = now;
+      base_cycles = sched_now;
+    }
+    uint64_t target = base_us + (sched_now - base_cycles) * 1000000 / SCHED_CPU_HZ;
+    if (target > now) {
+      PROFILE_BEGIN(PROFILE_THROTTLE);
+      sleep_until(from_us_since_boot(target));
+      PROFILE_END(PROFILE_THROTTLE);
+      now = target;
+    } else if (now - target > GOVERNOR_MAX_LAG_US) {
+      base_us = now;
+      base_cycles = sched_now;
+    }
+  }
+  throttled = throttle;
+
+  if (now - window_us >= 1000000) {
+    speed = (sched_now - window_cycles) * 100 * 1000000 / SCHED_CPU_HZ / (now - window_us);
+    window_us = now;
+    window_cycles = sched_now;
+    if (report) {
+      LOG_INFO("speed: %s, %d.%02dx\n", mode_names[mode], speed / 100, speed % 100);
+      report = 0;
+    }
+  }
+}
+
+void governor_init() {
+  window_us = time_us_64();
+  window_cycles = sched_now;
+  sched_add(governor_tick, GOVERNOR_TICK_CYCLES);
+}
+
+void governor_next_mode() {
+  mode = (mode + 1) % GOVERNOR_MODES;
+  report = 1; // once the next full second has been measured
+}
+
+static void governor_io() {
+  io_seen = 1;
+  io_until = sched_now + GOVERNOR_IO_CYCLES;
+}
+
+typedef int (*disc_op_t)(void *ctx, uint8_t *data, unsigned int offset, unsigned int len);
+
+typedef struct {
+  void *ctx;
+  disc_op_t read;
+  disc_op_t write;
+} backend_t;
+
+#if USE_SD
+static backend_t backends[DISC_SD_SLOTS];
+#else
+static backend_t backends[DISC_NUM_DRIVES];
+#endif
+
+static int governor_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  backend_t *backend = ctx;
+  governor_io();
+  return backend->read(backend->ctx, data, offset, len);
+}
+
+static int governor_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  backend_t *backend = ctx;
+  governor_io();
+  return backend->write(backend->ctx, data, offset, len);
+}
+
+void governor_disc_attach(disc_descr_t *disc, int drive) {
+  backends[drive] = (backend_t) {disc->op_ctx, disc->op_read, disc->op_write};
+  disc->op_ctx = &backends[drive];
+  disc->op_read = governor_read;
+  if (disc->op_write) disc->op_write = governor_write;
+}
+
+int governor_speed() {
+  return speed;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "umac.h"
+
+// Emulation speed: accurate throttles to the Mac Plus clock, max never waits,
+// turbo-on-I/O runs unthrottled while booting and around disc accesses
+typedef enum {
+  GOVERNOR_ACCURATE,
+  GOVERNOR_MAX,
+  GOVERNOR_TURBO_IO,
+  GOVERNOR_MODES
+} governor_mode_t;
+
+void governor_init();
+// Cycle to the next mode, may be called from the other core
+void governor_next_mode();
+// Run unthrottled for a while after each guest access to the drive (or SCSI
+// slot), in turbo-on-I/O mode. Goes on top of the drive's other layers.
+void governor_disc_attach(disc_descr_t *disc, int drive);
+// Emulated speed over the last second, in percent of a Mac Plus
+int governor_speed();
@@ -27,6 +27,13 @@
 
 #include "keyboard.h"
 #include "kbd.h"
+#include "video.h"
+#include "governor.h"
+#include "profile.h"
+#if USE_SD
+#include "state.h"
+#include "disc_manager.h"
+#endif
 
 int cursor_x = 0;
 int cursor_y = 0;
@@ -40,7 +47,26 @@ static int slow = 0, mouse_delta_x = 0, mouse_delta_y = 0;
 void hid_app_task(void)
 {
   input_event_t event = keyboard_poll();
-  if (/*!left_shift_pressed &&*/ event.code == KEY_RSHIFT && event.state == KEY_STATE_PRESSED) mouse_mode = 1 - mouse_mode;
+  if (event.code == KEY_F2 && event.modifiers == (MOD_CONTROL | MOD_ALT)) { // Ctrl+Alt+F2: overview
+    if (event.state == KEY_STATE_RELEASED) video_toggle_overview();
+  }
+  else if (event.code == KEY_F3 && event.modifiers == (MOD_CONTROL | MOD_ALT)) { // Ctrl+Alt+F3: speed mode
+    if (event.state == KEY_STATE_RELEASED) governor_next_mode();
+  }
+#if USE_SD
+  else if (event.code == KEY_F5 && event.modifiers == (MOD_CONTROL | MOD_ALT)) { // Ctrl+Alt+F5: save and suspend
+    if (event.state == KEY_STATE_RELEASED) state_request_save();
+  }
+  else if (event.code == KEY_F6 && event.modifiers == (MOD_CONTROL | MOD_ALT)) { // Ctrl+Alt+F6: drive 1 picker
+    if (event.state == KEY_STATE_RELEASED) disc_picker_request();
+  }
+#endif
+#if UMAC_PROFILE
+  else if (event.code == KEY_F7 && event.modifiers == (MOD_CONTROL | MOD_ALT)) { // Ctrl+Alt+F7: profile dump
+    if (event.state == KEY_STATE_RELEASED) profile_request_dump();
+  }
+#endif
+  else if (/*!left_shift_pressed &&*/ event.code == KEY_RSHIFT && event.state == KEY_STATE_PRESSED) mouse_mode = 1 - mouse_mode;
   else if (event.code != 0) {
     /*if (event.code == KEY_LSHIFT) {
       if (event.state == KEY_STATE_PRESSED) left_shift_pressed = 1;
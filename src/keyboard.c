@@ -5,6 +5,7 @@
 #include <hardware/i2c.h>
 
 #include "keyboard.h"
+#include "log.h"
 
 #define KBD_MOD    i2c1
 #define KBD_SDA    6
@@ -34,7 +35,7 @@ static int keyboard_modifiers;
 static int i2c_kbd_write(unsigned char* data, int size) {
   int retval = i2c_write_timeout_us(KBD_MOD, KBD_ADDR, data, size, false, 500000);
   if (retval == PICO_ERROR_GENERIC || retval == PICO_ERROR_TIMEOUT) {
-    printf("i2c_kbd_write: i2c write error\n");
+    LOG_WARN("i2c_kbd_write: i2c write error\n");
     return 0;
   }
   return 1;
@@ -43,7 +44,7 @@ static int i2c_kbd_write(unsigned char* data, int size) {
 static int i2c_kbd_read(unsigned char* data, int size) {
   int retval = i2c_read_timeout_us(KBD_MOD, KBD_ADDR, data, size, false, 500000);
   if (retval == PICO_ERROR_GENERIC || retval == PICO_ERROR_TIMEOUT) {
-    printf("i2c_kbd_read: i2c read error\n");
+    LOG_WARN("i2c_kbd_read: i2c read error\n");
     return 0;
   }
   return 1;
@@ -82,16 +83,37 @@ static void update_modifiers(unsigned short value) {
 
 #include "pico/bootrom.h"
 #include "hardware/watchdog.h"
+#if USE_SD
+#include "disc_async.h"
+#elif FLASH_LOG_KB
+#include "disc_flash_log.h"
+#define disc_sync() disc_flash_log_sync()
+#else
+#define disc_sync()
+#endif
+#if USE_OVERLAY
+#include "disc_overlay.h"
+#endif
 
 static void keyboard_check_special_keys(unsigned short value) {
   if ((value & 0xff) == KEY_STATE_RELEASED && keyboard_modifiers == (MOD_CONTROL|MOD_ALT)) {
     if ((value >> 8) == KEY_F1) {
       printf("rebooting to usb boot\n");
+      disc_sync();
       reset_usb_boot(0, 0);
     } else if ((value >> 8) == KEY_DELETE) {
       printf("rebooting via watchdog\n");
+      disc_sync();
       watchdog_reboot(0, 0, 0);
       watchdog_enable(0, 1);
+#if USE_OVERLAY
+    } else if ((value >> 8) == KEY_F4) {
+      printf("discarding umac0.delta and rebooting\n");
+      disc_sync();
+      watchdog_hw->scratch[0] = DISC_OVERLAY_RESET_MAGIC;
+      watchdog_reboot(0, 0, 0);
+      watchdog_enable(0, 1);
+#endif
     }
   }
 }
@@ -6,15 +6,9 @@
 #include "hardware/dma.h"
 
 #include "lcd_3bit.h"
+#include "lcd_bus.h"
 #include "font.h"
 
-#define LCD_SCK 10
-#define LCD_TX  11
-#define LCD_RX  12
-#define LCD_CS  13
-#define LCD_DC  14
-#define LCD_RST 15
-
 static int lcd_write_spi(void *buf, size_t len) {
   return spi_write_blocking(spi1, buf, len);
 }
@@ -24,8 +18,7 @@ static inline void lcd_write_spi_dc(void *buf, size_t len, int dc) {
   lcd_write_spi(buf, len);
 }
 
-#define NUMARGS(...)  (sizeof((int[]){__VA_ARGS__}) / sizeof(int))
-static int lcd_write_reg_num(int len, ...) {
+int lcd_write_reg_num(int len, ...) {
   u8 buf[128];
   va_list args;
   int i;
@@ -45,13 +38,34 @@ static int lcd_write_reg_num(int len, ...) {
 
   return 0;
 }
-#define lcd_write_reg(...) \
-    lcd_write_reg_num(NUMARGS(__VA_ARGS__), __VA_ARGS__)
 
-#define REGION_READ 0
-#define REGION_WRITE 1
+// Asynchronous pixel transfers, paced by the SPI TX DREQ
+static int lcd_dma_chan = -1;
+static dma_channel_config lcd_dma_config;
+static int lcd_window_open = 0;
+
+static void lcd_dma_init() {
+  lcd_dma_chan = dma_claim_unused_channel(true);
+  lcd_dma_config = dma_channel_get_default_config(lcd_dma_chan);
+  channel_config_set_transfer_data_size(&lcd_dma_config, DMA_SIZE_8);
+  channel_config_set_read_increment(&lcd_dma_config, true);
+  channel_config_set_write_increment(&lcd_dma_config, false);
+  channel_config_set_dreq(&lcd_dma_config, DREQ_SPI1_TX);
+}
+
+void lcd_wait() {
+  if (!lcd_window_open) return;
+  dma_channel_wait_for_finish_blocking(lcd_dma_chan);
+  while (spi_is_busy(spi1));
+  // nothing reads the RX FIFO during DMA, drop what came in and clear the overrun
+  while (spi_is_readable(spi1)) (void) spi_get_hw(spi1)->dr;
+  spi_get_hw(spi1)->icr = SPI_SSPICR_RORIC_BITS;
+  gpio_put(LCD_CS, 1);
+  lcd_window_open = 0;
+}
 
-static void lcd_set_region(int x1, int y1, int x2, int y2, int rw) {
+void lcd_set_region(int x1, int y1, int x2, int y2, int rw) {
+  lcd_wait();
   gpio_put(LCD_CS, 0);
   lcd_write_reg(0x2A, (x1 >> 8), (x1 & 0xFF), (x2 >> 8), (x2 & 0xFF));
   lcd_write_reg(0x2B, (y1 >> 8), (y1 & 0xFF), (y2 >> 8), (y2 & 0xFF));
@@ -75,6 +89,27 @@ void lcd_draw(u8* pixels, int x, int y, int width, int height) {
   gpio_put(LCD_CS, 1);
 }
 
+void lcd_begin_window(int x, int y, int width, int height) {
+  y %= MEM_HEIGHT;
+  lcd_set_region(x, y, x + width - 1, y + height - 1, REGION_WRITE);
+  lcd_window_open = 1;
+}
+
+void lcd_stream(u8* pixels, int len) {
+  // still inside the same RAMWR, only the previous span needs to have been queued
+  dma_channel_wait_for_finish_blocking(lcd_dma_chan);
+  dma_channel_configure(lcd_dma_chan, &lcd_dma_config, &spi_get_hw(spi1)->dr, pixels, len, true);
+}
+
+void lcd_end_window() {
+  lcd_wait();
+}
+
+void lcd_draw_async(u8* pixels, int x, int y, int width, int height) {
+  lcd_begin_window(x, y, width, height);
+  lcd_stream(pixels, width * height / 2);
+}
+
 void lcd_fill(u8 color, int x, int y, int width, int height) {
   y %= MEM_HEIGHT;
   lcd_set_region(x, y, x + width - 1, y + height - 1, REGION_WRITE);
@@ -105,13 +140,16 @@ int lcd_clear() {
 
 void lcd_scroll(int lines) {
   lines %= MEM_HEIGHT;
+  lcd_wait();
   gpio_put(LCD_CS, 0);
   lcd_write_reg(0x37, (lines >> 8), (lines & 0xFF));
   gpio_put(LCD_CS, 1);
 }
 
 void lcd_setup_scrolling(int top_fixed_lines, int bottom_fixed_lines) {
-  int vertical_scrolling_area = HEIGHT - (top_fixed_lines + bottom_fixed_lines);
+  // the three areas have to add up to the whole GRAM, not just the visible part
+  int vertical_scrolling_area = MEM_HEIGHT - (top_fixed_lines + bottom_fixed_lines);
+  lcd_wait();
   gpio_put(LCD_CS, 0);
   lcd_write_reg(0x33, (top_fixed_lines >> 8), (top_fixed_lines & 0xFF), (vertical_scrolling_area >> 8), 
     (vertical_scrolling_area & 0xFF), (bottom_fixed_lines >> 8), (bottom_fixed_lines & 0xff));
@@ -267,6 +305,8 @@ void lcd_init() {
   gpio_set_function(LCD_RX, GPIO_FUNC_SPI);
   gpio_set_input_hysteresis_enabled(LCD_RX, true);
 
+  lcd_dma_init();
+
   gpio_put(LCD_CS, 1);
   gpio_put(LCD_RST, 1);
 
@@ -312,24 +352,28 @@ void lcd_init() {
 }
 
 void lcd_blank() {
+  lcd_wait();
   gpio_put(LCD_CS, 0);
   lcd_write_reg(0x10);                      // Enter Sleep
   gpio_put(LCD_CS, 1);
 }
 
 void lcd_unblank() {
+  lcd_wait();
   gpio_put(LCD_CS, 0);
   lcd_write_reg(0x11);                      // Exit Sleep
   gpio_put(LCD_CS, 1);
 }
 
 void lcd_on() {
+  lcd_wait();
   gpio_put(LCD_CS, 0);
   lcd_write_reg(0x29);                      // Display on
   gpio_put(LCD_CS, 1);
 }
 
 void lcd_off() {
+  lcd_wait();
   gpio_put(LCD_CS, 0);
   lcd_write_reg(0x29);                      // Display off
   gpio_put(LCD_CS, 1);
@@ -13,6 +13,14 @@
 #define RGB(r,g,b) ((u8)(((r != 0) << 2) | ((g != 0) << 1) | (b != 0)))
 
 void lcd_draw(u8* pixels, int x, int y, int width, int height);
+// Start sending pixels with DMA and return, the buffer must stay untouched until the next lcd call
+void lcd_draw_async(u8* pixels, int x, int y, int width, int height);
+// Wait for the pending asynchronous transfer, if any
+void lcd_wait();
+// Open a window once, then stream pixel spans (2 pixels per byte) into it with DMA
+void lcd_begin_window(int x, int y, int width, int height);
+void lcd_stream(u8* pixels, int len);
+void lcd_end_window();
 void lcd_fill(u8 color, int x, int y, int width, int height);
 int lcd_clear();
 void lcd_draw_char(int x, int y, u8 fg, u8 bg, char c);
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "types.h"
+
+// Panel wiring on SPI1 and the command helpers of lcd_3bit.c, shared with the
+// RGB565 path in lcd.c
+
+#define LCD_SCK 10
+#define LCD_TX  11
+#define LCD_RX  12
+#define LCD_CS  13
+#define LCD_DC  14
+#define LCD_RST 15
+
+#define REGION_READ 0
+#define REGION_WRITE 1
+
+// Send a command byte then its parameters, CS must already be low
+int lcd_write_reg_num(int len, ...);
+#define NUMARGS(...)  (sizeof((int[]){__VA_ARGS__}) / sizeof(int))
+#define lcd_write_reg(...) \
+    lcd_write_reg_num(NUMARGS(__VA_ARGS__), __VA_ARGS__)
+
+// Wait for the pending DMA transfer, select the panel and open a GRAM window,
+// left selected for the pixels that follow
+void lcd_set_region(int x1, int y1, int x2, int y2, int rw);
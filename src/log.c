@@ -0,0 +1,129 @@
+/* Ring-buffered logging:
+ *
+ * Each core owns a single-producer ring that only core 0 consumes, so pushing
+ * a record is a few stores and a barrier, without locks. Formatting and the
+ * UART transfer happen later, from core 0's main loop, with DMA sending the
+ * text while the loop goes on.
+ *
+ * printf() still writes to the same UART, from either core. Its output goes
+ * through a stdio driver standing in for stdio_uart, which waits for the DMA
+ * to finish first; a mutex keeps log_drain() from starting a transfer in the
+ * middle of it, so lines from both never mix.
+ */
+
+#include <stdio.h>
+
+#include "pico/mutex.h"
+#include "pico/stdio/driver.h"
+#include "pico/stdio_uart.h"
+#include "hardware/dma.h"
+#include "hardware/sync.h"
+#include "hardware/uart.h"
+
+#include "log.h"
+
+#define LOG_RING_SIZE 64 // records per core, a power of two
+#define LOG_TEXT_SIZE 256
+
+typedef struct {
+  const char* fmt;
+  uint32_t args[4];
+} log_record_t;
+
+typedef struct {
+  log_record_t records[LOG_RING_SIZE];
+  volatile uint32_t head; // written by the producing core only
+  volatile uint32_t tail; // written by log_drain() only
+  volatile uint32_t dropped;
+} log_ring_t;
+
+static log_ring_t rings[2];
+
+static char text[LOG_TEXT_SIZE];
+static int dma_chan = -1;
+static uint32_t reported_dropped[2];
+auto_init_mutex(uart_mutex); // held by stdio output and while starting a transfer
+
+void __not_in_flash_func(log_push)(const char* fmt, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+  log_ring_t* ring = &rings[get_core_num()];
+  uint32_t head = ring->head;
+  if (head - ring->tail == LOG_RING_SIZE) {
+    ring->dropped++;
+    return;
+  }
+  log_record_t* r = &ring->records[head % LOG_RING_SIZE];
+  r->fmt = fmt;
+  r->args[0] = a;
+  r->args[1] = b;
+  r->args[2] = c;
+  r->args[3] = d;
+  __dmb(); // the record is complete before it is published
+  ring->head = head + 1;
+}
+
+static void log_stdio_out_chars(const char* buf, int len) {
+  mutex_enter_blocking(&uart_mutex);
+  if (dma_chan >= 0) dma_channel_wait_for_finish_blocking(dma_chan);
+  stdio_uart.out_chars(buf, len);
+  mutex_exit(&uart_mutex);
+}
+
+static void log_stdio_out_flush() {
+  if (stdio_uart.out_flush) stdio_uart.out_flush();
+}
+
+static int log_stdio_in_chars(char* buf, int len) {
+  return stdio_uart.in_chars(buf, len);
+}
+
+static stdio_driver_t log_stdio = {
+  .out_chars = log_stdio_out_chars,
+  .out_flush = log_stdio_out_flush,
+  .in_chars = log_stdio_in_chars,
+#if PICO_STDIO_ENABLE_CRLF_SUPPORT
+  .crlf_enabled = PICO_STDIO_DEFAULT_CRLF,
+#endif
+};
+
+static void log_dma_init() {
+  dma_chan = dma_claim_unused_channel(true);
+  dma_channel_config config = dma_channel_get_default_config(dma_chan);
+  channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+  channel_config_set_read_increment(&config, true);
+  channel_config_set_write_increment(&config, false);
+  channel_config_set_dreq(&config, uart_get_dreq(uart_default, true));
+  dma_channel_configure(dma_chan, &config, &uart_get_hw(uart_default)->dr, text, 0, false);
+}
+
+void log_init() {
+  log_dma_init();
+  stdio_set_driver_enabled(&stdio_uart, false);
+  stdio_set_driver_enabled(&log_stdio, true);
+}
+
+void log_drain() {
+  if (dma_channel_is_busy(dma_chan)) return;
+  if (!mutex_try_enter(&uart_mutex, NULL)) return; // a printf() is going on
+
+  int len = 0;
+  for (int core = 0; core < 2; core++) {
+    log_ring_t* ring = &rings[core];
+    uint32_t dropped = ring->dropped;
+    if (dropped != reported_dropped[core] && len < LOG_TEXT_SIZE / 2) {
+      len += snprintf(text + len, LOG_TEXT_SIZE - len, "log: core %d dropped %lu records\n", core,
+                      (unsigned long) (dropped - reported_dropped[core]));
+      reported_dropped[core] = dropped;
+    }
+    // stop once the buffer might not hold a whole line, the rest waits for the next call
+    while (ring->tail != ring->head && len < LOG_TEXT_SIZE / 2) {
+      __dmb();
+      log_record_t* r = &ring->records[ring->tail % LOG_RING_SIZE];
+      int n = snprintf(text + len, LOG_TEXT_SIZE - len, r->fmt, r->args[0], r->args[1], r->args[2], r->args[3]);
+      len = n < LOG_TEXT_SIZE - len ? len + n : LOG_TEXT_SIZE - 1;
+      __dmb(); // done reading the record before handing the slot back
+      ring->tail++;
+    }
+  }
+  if (len > 0) dma_channel_transfer_from_buffer_now(dma_chan, text, len);
+  mutex_exit(&uart_mutex);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+// Non-blocking log: records (format pointer plus up to 4 32-bit arguments) go
+// into a per-core ring and are only formatted by log_drain() on core 0. Formats
+// must be literals and %s arguments must outlive the record. Records are
+// dropped and counted when a ring is full.
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Set up the DMA channel and route printf() around the transfers, after stdio_init_all()
+void log_init();
+void log_push(const char* fmt, uint32_t a, uint32_t b, uint32_t c, uint32_t d);
+// Send pending records to the UART with DMA, returns at once if it is still busy
+void log_drain();
+
+#define LOG_PUSH4(fmt, a, b, c, d, ...) \
+    log_push(fmt, (uint32_t) (a), (uint32_t) (b), (uint32_t) (c), (uint32_t) (d))
+#define LOG_AT(level, ...) \
+    do { if ((level) <= LOG_LEVEL) LOG_PUSH4(__VA_ARGS__, 0, 0, 0, 0); } while (0)
+
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
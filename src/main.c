@@ -51,6 +51,37 @@
 
 #include "keyboard.h"
 #include "lcd_3bit.h"
+#include "mem_hooks.h"
+#include "sched.h"
+#include "governor.h"
+#include "disc_cache.h"
+#include "disc_sd.h"
+#include "disc_async.h"
+#include "disc_manager.h"
+#include "disc_prefetch.h"
+#if USE_SCSI
+#include "scsi.h"
+#endif
+#include "state.h"
+#if PACK_DISC
+#include "disc_packed.h"
+#endif
+#if FLASH_LOG_KB
+#include "disc_flash_log.h"
+#include "pico/flash.h"
+#endif
+#if USE_OVERLAY
+#include "disc_overlay.h"
+#include "hardware/watchdog.h"
+#endif
+#include "log.h"
+#include "profile.h"
+#if ROM_SHADOW
+#include "rom_shadow.h"
+#endif
+#if PREDECODE
+#include "predecode.h"
+#endif
 
 #include "umac.h"
 
@@ -73,7 +104,7 @@ extern int cursor_button;
 
 // Mac binary data:  disc and ROM images
 #ifndef USE_SD
-static const uint8_t umac_disc[] = {
+static const uint8_t umac_disc[] __attribute__((aligned(4))) = {
 #include "umac-disc.h"
 };
 #endif
@@ -103,26 +134,9 @@ static int umac_cursor_x = 0;
 static int umac_cursor_y = 0;
 static int umac_cursor_button = 0;
 
-static void poll_umac()
+// mouse and keyboard events are handed over at a fixed emulated rate
+static void poll_input()
 {
-  static absolute_time_t last_1hz = 0;
-  static absolute_time_t last_vsync = 0;
-  absolute_time_t now = get_absolute_time();
-
-  umac_loop();
-
-  int64_t p_1hz = absolute_time_diff_us(last_1hz, now);
-  int64_t p_vsync = absolute_time_diff_us(last_vsync, now);
-  if (p_vsync >= 16667) {
-    /* FIXME: Trigger this off actual vsync */
-    umac_vsync_event();
-    last_vsync = now;
-  }
-  if (p_1hz >= 1000000) {
-    umac_1hz_event();
-    last_1hz = now;
-  }
-
   int update = 0;
   int dx = 0;
   int dy = 0;
@@ -152,36 +166,35 @@ static void poll_umac()
   }
 }
 
-#if USE_SD
-static int disc_do_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len)
+static void poll_umac()
 {
-  printf("sd read %p %d %d\n", data, offset, len);
-  FIL *fp = (FIL *)ctx;
-  f_lseek(fp, offset);
-  unsigned int did_read = 0;
-  FRESULT fr = f_read(fp, data, len, &did_read);
-  if (fr != FR_OK || len != did_read) {
-    printf("disc: f_read returned %d, read %u (of %u)\n", fr, did_read, len);
-    return -1;
-  }
-  return 0;
+  PROFILE_BEGIN(PROFILE_LOOP);
+  umac_loop();
+  PROFILE_END(PROFILE_LOOP);
+  sched_poll();
 }
 
-static int disc_do_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len)
+static void vsync_event()
 {
-  printf("sd write %p %d %d\n", data, offset, len);
-  FIL *fp = (FIL *)ctx;
-  f_lseek(fp, offset);
-  unsigned int did_write = 0;
-  FRESULT fr = f_write(fp, data, len, &did_write);
-  if (fr != FR_OK || len != did_write) {
-    printf("disc: f_write returned %d, read %u (of %u)\n", fr, did_write, len);
-    return -1;
-  }
-  return 0;
+  PROFILE_BEGIN(PROFILE_VSYNC);
+  umac_vsync_event();
+  PROFILE_END(PROFILE_VSYNC);
+}
+
+static void second_event()
+{
+  PROFILE_BEGIN(PROFILE_1HZ);
+  umac_1hz_event();
+  PROFILE_END(PROFILE_1HZ);
+}
+
+#if USE_SD
+// dirty cached sectors reach the card at least once a second
+static void disc_flush_tick()
+{
+  disc_cache_flush();
 }
 
-static FIL discfp, discfp2;
 static FATFS fatfs;
 static char* fs_error_strings[20] = {
   "Succeeded",
@@ -206,6 +219,13 @@ static char* fs_error_strings[20] = {
   "Given parameter is invalid",
 };
 
+#elif !PACK_DISC
+// reads go through a function rather than the base pointer so that they can be noticed
+static int disc_flash_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len)
+{
+  memcpy(data, (const uint8_t *)ctx + offset, len);
+  return 0;
+}
 #endif
 
 static int disc_setup(disc_descr_t discs[DISC_NUM_DRIVES])
@@ -240,7 +260,11 @@ static int disc_setup(disc_descr_t discs[DISC_NUM_DRIVES])
   }
 
   char* disc0_name = "umac0.img";
-  result = f_open(&discfp2, disc0_name, FA_OPEN_EXISTING | FA_READ | FA_WRITE);
+#if USE_OVERLAY
+  result = disc_sd_open(&discs[0], 0, disc0_name, 1);
+#else
+  result = disc_sd_open(&discs[0], 0, disc0_name, 0);
+#endif
   if (result != FR_OK) {
     printf("f_open: %s (%d)\n", fs_error_strings[result], result);
     lcd_printf(0, 10 * (line++), 0x6, 0, "f_open: %s (%d)", fs_error_strings[result], result);
@@ -248,29 +272,57 @@ static int disc_setup(disc_descr_t discs[DISC_NUM_DRIVES])
     goto no_sd;
   }
 
-  discs[0].base = 0; // Means use R/W ops
-  discs[0].read_only = 0;
-  discs[0].size = f_size(&discfp2);
-  discs[0].op_ctx = &discfp2;
-  discs[0].op_read = disc_do_read;
-  discs[0].op_write = disc_do_write;
-
-  lcd_printf(0, 10 * (line++), 0x6, 0, "loading umac1.img from sdcard");
-  char* disc1_name = "umac1.img";
-  result = f_open(&discfp, disc1_name, FA_OPEN_EXISTING | FA_READ | FA_WRITE);
+  printf("%s: %s\n", disc0_name, disc_sd_mode(0));
+  lcd_printf(0, 10 * (line++), 0x6, 0, "%s", disc_sd_mode(0));
+#if USE_OVERLAY
+  // the base image stays pristine, changes go to the delta (emptied by ctrl-alt-F4)
+  result = disc_overlay_attach(&discs[0], 0, "umac0.delta");
   if (result != FR_OK) {
-    printf("f_open: %s (%d)\n", fs_error_strings[result], result);
-    lcd_printf(0, 10 * (line++), 0x6, 0, "f_open: %s (%d)", fs_error_strings[result], result);
-    sleep_ms(100);
-    return 1;
+    printf("umac0.delta: %s (%d)\n", fs_error_strings[result], result);
+    lcd_printf(0, 10 * (line++), 0x6, 0, "umac0.delta: %s (%d), read only", fs_error_strings[result], result);
+  } else {
+    printf("umac0.delta: %u changed sectors\n", disc_overlay_sectors(0));
+    lcd_printf(0, 10 * (line++), 0x6, 0, "umac0.delta: %u changed sectors", disc_overlay_sectors(0));
   }
+  watchdog_hw->scratch[0] = 0; // a pending reset has been done
+#endif
+  disc_async_attach(&discs[0], 0);
+  disc_prefetch_attach(&discs[0], 0);
+  disc_cache_attach(&discs[0], 0);
+  governor_disc_attach(&discs[0], 0);
+#if PREDECODE
+  predecode_disc_attach(&discs[0], 0);
+#endif
+  profile_disc_attach(&discs[0], 0);
+
+#if USE_SCSI
+  // SCSI disks hdN.img, with N the SCSI ID
+  for (int id = 0; id < SCSI_NUM_TARGETS; id++) {
+    char hd_name[] = "hd0.img";
+    hd_name[2] = '0' + id;
+    disc_descr_t hd;
+    if (disc_sd_open(&hd, DISC_NUM_DRIVES + id, hd_name, 0) != FR_OK) continue;
+    disc_async_attach(&hd, DISC_NUM_DRIVES + id);
+    governor_disc_attach(&hd, DISC_NUM_DRIVES + id);
+    scsi_attach(id, &hd);
+    printf("%s: SCSI ID %d, %ld blocks, %s\n", hd_name, id, hd.size / 512, disc_sd_mode(DISC_NUM_DRIVES + id));
+    lcd_printf(0, 10 * (line++), 0x6, 0, "%s: SCSI ID %d, %ld MB", hd_name, id, hd.size >> 20);
+  }
+#endif
 
-  discs[1].base = 0; // Means use R/W ops
-  discs[1].read_only = 0;
-  discs[1].size = f_size(&discfp);
-  discs[1].op_ctx = &discfp;
-  discs[1].op_read = disc_do_read;
-  discs[1].op_write = disc_do_write;
+  // drive 1 is only opened when the guest first reads it
+  int found = disc_manager_scan(disc0_name);
+  lcd_printf(0, 10 * (line++), 0x6, 0, "%d more disc images, ctrl-alt-F6 to pick", found);
+  if (disc_manager_attach(&discs[1])) {
+    disc_async_attach(&discs[1], 1);
+    disc_prefetch_attach(&discs[1], 1);
+    disc_cache_attach(&discs[1], 1);
+    governor_disc_attach(&discs[1], 1);
+#if PREDECODE
+    predecode_disc_attach(&discs[1], 1);
+#endif
+    profile_disc_attach(&discs[1], 1);
+  }
 
   printf("loaded SD (size=%ld)\n", discs[0].size);
   return 1;
@@ -284,10 +336,28 @@ no_sd:
   /* If we don't find (or look for) an SD-based image, attempt
    * to use in-flash disc image:
    */
-  discs[0].base = (void *)umac_disc;
+#if PACK_DISC
+  if (disc_packed_attach(&discs[0], umac_disc) != 0) {
+    printf("flash img is not packed\n");
+    return 0;
+  }
+  printf("using packed flash img (%ld bytes from %d)\n", discs[0].size, (int)sizeof(umac_disc));
+#else
+  discs[0].base = 0; // Means use R/W ops
   discs[0].read_only = 1;
   discs[0].size = sizeof(umac_disc);
+  discs[0].op_ctx = (void *)umac_disc;
+  discs[0].op_read = disc_flash_read;
   printf("using flash img\n");
+#endif
+#if FLASH_LOG_KB
+  if (disc_flash_log_attach(&discs[0]) != 0) printf("flash img is read only\n");
+#endif
+  governor_disc_attach(&discs[0], 0);
+#if PREDECODE
+  predecode_disc_attach(&discs[0], 0);
+#endif
+  profile_disc_attach(&discs[0], 0);
   return 1;
 #endif
 }
@@ -297,15 +367,45 @@ static void core1_main()
   disc_descr_t discs[DISC_NUM_DRIVES] = {0};
 
   printf("Core 1 started\n");
+#if FLASH_LOG_KB
+  flash_safe_execute_core_init(); // core 0 parks us while it programs the flash log
+#endif
   while (!disc_setup(discs));
 
-  umac_init(umac_ram, (void *)umac_rom, discs);
+#if ROM_SHADOW
+  const uint8_t *rom = rom_shadow(umac_rom, sizeof(umac_rom));
+#else
+  const uint8_t *rom = umac_rom;
+#endif
+  umac_init(umac_ram, (void *)rom, discs);
+  mem_hooks_init(umac_get_fb_offset(), umac_ram, rom);
+#if PREDECODE
+  predecode_init(umac_ram);
+#endif
+
+  int resumed = 0;
+#if USE_SD
+  state_init(umac_ram, RAM_SIZE);
+  resumed = state_resume() == 0;
+  if (resumed) printf("resumed from saved state\n");
+#endif
+
+  sched_add(vsync_event, SCHED_VSYNC_CYCLES);
+  sched_add(second_event, SCHED_CPU_HZ);
+  sched_add(poll_input, SCHED_VSYNC_CYCLES / 4);
+  governor_init();
+#if USE_SD
+  sched_add(disc_flush_tick, SCHED_CPU_HZ);
+  sched_add(disc_async_poll, SCHED_VSYNC_CYCLES);
+  sched_add(state_poll, SCHED_VSYNC_CYCLES / 4);
+#endif
 
   /* video runs on core 0 */
   video_init((uint32_t *)(umac_ram + umac_get_fb_offset()));
-  fb_printf(0, 0, 1, "starging umac");
+  if (!resumed) fb_printf(0, 0, 1, "starging umac");
 
   printf("Enjoyable Mac times now begin:\n\n");
+  profile_init();
 
   while (true) {
     poll_umac();
@@ -321,6 +421,7 @@ int     main()
   */
 
   stdio_init_all();
+  log_init();
 
   lcd_init();
   lcd_clear();
@@ -338,6 +439,15 @@ int     main()
   while (true) {
     //hid_app_task();
     video_update();
+#if USE_SD
+    disc_async_service(); // staged disc writes, between frames
+    disc_prefetch_service();
+    disc_picker_task();
+#elif FLASH_LOG_KB
+    disc_flash_log_service(); // staged disc writes, once a segment is full or writes stop
+#endif
+    profile_task();
+    log_drain();
   }
 
   return 0;
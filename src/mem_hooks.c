@@ -0,0 +1,255 @@
+/* Memory access hooks:
+ *
+ * The Musashi core calls umac's cpu_write_{byte,word,long}() for every guest
+ * store. They are wrapped at link time (-Wl,--wrap) so that writes landing in
+ * the framebuffer mark the corresponding scanlines dirty for video_update(),
+ * and so that the VIA and SCC configuration can be saved with the machine.
+ * With USE_SCSI, byte accesses to the 5380 are routed to src/scsi.c. With
+ * UMAC_PROFILE, accesses are timed (src/profile.c). With PREDECODE, writes
+ * drop the cached opcodes they overwrite.
+ *
+ * Reads and writes are wrapped as well to skip umac's address decoding for
+ * RAM and ROM: a table of the 256 64K pages of the 24-bit bus holds a host
+ * pointer for the pages that are plain memory, one indexed load away, and
+ * NULL for the others (I/O, mirrors, a partial last page of RAM), left to
+ * umac. Which page is what is set at compile time from MEMSIZE (RAM_SIZE),
+ * and the ROM overlay switch at boot only rewrites the RAM entries. Builds on
+ * the host as well, for the tools that boot umac (dirty-lines in
+ * tools/check.sh).
+ */
+
+#include <stddef.h>
+
+#ifdef PICO
+#include "pico.h"
+#else
+#define __not_in_flash_func(f) f
+#endif
+
+#include "umac.h"
+#include "video.h"
+#include "mem_hooks.h"
+#include "profile.h"
+#if PREDECODE
+#include "predecode.h"
+#endif
+#if USE_SCSI
+#include "scsi.h"
+#endif
+
+#define FB_BYTES (DISP_WIDTH * DISP_HEIGHT / 8)
+#define FB_STRIDE (DISP_WIDTH / 8)
+
+void __real_cpu_write_byte(unsigned int address, unsigned int value);
+void __real_cpu_write_word(unsigned int address, unsigned int value);
+void __real_cpu_write_long(unsigned int address, unsigned int value);
+unsigned int __real_cpu_read_byte(unsigned int address);
+unsigned int __real_cpu_read_word(unsigned int address);
+unsigned int __real_cpu_read_long(unsigned int address);
+
+// Mac Plus I/O, byte accesses only: VIA registers every 512 bytes, SCC
+// control ports with channel A on address bit 1
+#define VIA_BASE 0xe80000
+#define VIA_END 0xf00000
+#define VIA_REG0 0xefe1fe
+#define SCC_WRITE_BASE 0xa00000
+#define SCC_WRITE_END 0xc00000
+#define SCC_CONTROL_A 0xbffffb
+#define SCC_CONTROL_B 0xbffff9
+#define VIA_OVERLAY 0x10 // port A bit 4, the ROM mapped at 0 at boot
+
+#define PAGE_SHIFT 16
+#define PAGE_MASK 0xffff
+#define PAGE_OF(address) (((address) >> PAGE_SHIFT) & 0xff)
+#define RAM_PAGES (RAM_SIZE >> PAGE_SHIFT)
+#define ROM_BASE 0x400000
+#define ROM_SIZE 0x20000
+
+enum {
+  PAGE_IO,
+  PAGE_RAM,
+  PAGE_ROM,
+};
+
+static const uint8_t page_layout[256] = {
+  [0 ... RAM_PAGES - 1] = PAGE_RAM,
+  [ROM_BASE >> PAGE_SHIFT ... ((ROM_BASE + ROM_SIZE) >> PAGE_SHIFT) - 1] = PAGE_ROM,
+};
+
+static uint8_t *read_pages[256];
+static uint8_t *write_pages[256];
+static uint8_t *ram_base;
+
+static unsigned int fb_start = 0;
+
+mem_io_shadow_t mem_io_shadow;
+static uint8_t scc_pointer[2];
+static unsigned int overlay = VIA_OVERLAY; // on at reset
+
+// With the overlay, the ROM is at 0 and the RAM moves up: both left to umac
+static void map_ram() {
+  for (int page = 0; page < RAM_PAGES; page++) {
+    uint8_t *host = overlay ? NULL : ram_base + (page << PAGE_SHIFT);
+    read_pages[page] = host;
+    write_pages[page] = host;
+  }
+}
+
+void mem_hooks_init(unsigned int fb_offset, uint8_t *ram, const uint8_t *rom) {
+  fb_start = fb_offset;
+  ram_base = ram;
+  for (int page = 0; page < 256; page++)
+    if (page_layout[page] == PAGE_ROM) read_pages[page] = (uint8_t *) rom + (page << PAGE_SHIFT) - ROM_BASE;
+  map_ram();
+}
+
+// A store touches at most two lines, test both ends. Called after the store
+// has been done so that video_update() never clears a flag before the data lands.
+static inline void track_write(unsigned int address, unsigned int size) {
+#if PREDECODE
+  predecode_write(address, size);
+#endif
+  unsigned int first = address - fb_start;
+  unsigned int last = first + size - 1;
+  if (first < FB_BYTES) video_mark_dirty(first / FB_STRIDE);
+  if (last < FB_BYTES) video_mark_dirty(last / FB_STRIDE);
+}
+
+// Keeps the last value of the VIA and SCC write registers. The SCC's WR0 selects
+// the register the next control write goes to, so its pointer is followed too.
+static void track_io(unsigned int address, unsigned int value) {
+  if (address >= VIA_BASE && address < VIA_END) {
+    int reg = (address >> 9) & 0xf;
+    if (reg == 14) {
+      if (value & 0x80) mem_io_shadow.via_ier |= value & 0x7f;
+      else mem_io_shadow.via_ier &= ~value;
+    } else {
+      // port A, with or without handshake: what is at address 0 changes with the overlay
+      if ((reg == 1 || reg == 15) && (value & VIA_OVERLAY) != overlay) {
+        overlay = value & VIA_OVERLAY;
+        map_ram();
+#if PREDECODE
+        predecode_flush();
+#endif
+      }
+      // one port A whichever way it was written, replayed through reg 15
+      mem_io_shadow.via[reg == 1 ? 15 : reg] = value;
+    }
+  } else if (address >= SCC_WRITE_BASE && address < SCC_WRITE_END && !(address & 4)) {
+    int channel = (address >> 1) & 1;
+    int reg = scc_pointer[channel];
+    mem_io_shadow.scc[channel][reg] = value;
+    scc_pointer[channel] = reg == 0 ? (value & 7) | ((value & 0x38) == 0x08 ? 8 : 0) : 0;
+  }
+}
+
+// Guest memory is in 68000 byte order; words are even, longs may straddle pages
+static inline void write_byte(unsigned int address, unsigned int value) {
+  uint8_t *page = write_pages[PAGE_OF(address)];
+  if (page) page[address & PAGE_MASK] = value;
+  else __real_cpu_write_byte(address, value);
+}
+
+static inline void write_word(unsigned int address, unsigned int value) {
+  uint8_t *page = write_pages[PAGE_OF(address)];
+  if (page && !(address & 1)) {
+    uint8_t *p = page + (address & PAGE_MASK);
+    p[0] = value >> 8;
+    p[1] = value;
+  } else {
+    __real_cpu_write_word(address, value);
+  }
+}
+
+static inline void write_long(unsigned int address, unsigned int value) {
+  uint8_t *page = write_pages[PAGE_OF(address)];
+  if (page && !(address & 1) && (address & PAGE_MASK) <= PAGE_MASK - 3) {
+    uint8_t *p = page + (address & PAGE_MASK);
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+  } else {
+    __real_cpu_write_long(address, value);
+  }
+}
+
+static inline unsigned int read_byte(unsigned int address) {
+  uint8_t *page = read_pages[PAGE_OF(address)];
+  return page ? page[address & PAGE_MASK] : __real_cpu_read_byte(address);
+}
+
+static inline unsigned int read_word(unsigned int address) {
+  uint8_t *page = read_pages[PAGE_OF(address)];
+  if (!page || (address & 1)) return __real_cpu_read_word(address);
+  const uint8_t *p = page + (address & PAGE_MASK);
+  return p[0] << 8 | p[1];
+}
+
+static inline unsigned int read_long(unsigned int address) {
+  uint8_t *page = read_pages[PAGE_OF(address)];
+  if (!page || (address & 1) || (address & PAGE_MASK) > PAGE_MASK - 3) return __real_cpu_read_long(address);
+  const uint8_t *p = page + (address & PAGE_MASK);
+  return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+void __not_in_flash_func(__wrap_cpu_write_byte)(unsigned int address, unsigned int value) {
+#if USE_SCSI
+  if (scsi_is_io(address)) {
+    scsi_write(address, value);
+    return;
+  }
+#endif
+  PROFILE_SAMPLED(PROFILE_MEM_WRITE, write_byte(address, value));
+  if (address >= SCC_WRITE_BASE) track_io(address, value);
+  else track_write(address, 1);
+}
+
+void __not_in_flash_func(__wrap_cpu_write_word)(unsigned int address, unsigned int value) {
+  PROFILE_SAMPLED(PROFILE_MEM_WRITE, write_word(address, value));
+  track_write(address, 2);
+}
+
+void __not_in_flash_func(__wrap_cpu_write_long)(unsigned int address, unsigned int value) {
+  PROFILE_SAMPLED(PROFILE_MEM_WRITE, write_long(address, value));
+  track_write(address, 4);
+}
+
+unsigned int __not_in_flash_func(__wrap_cpu_read_byte)(unsigned int address) {
+#if USE_SCSI
+  if (scsi_is_io(address)) return scsi_read(address);
+#endif
+  unsigned int value;
+  PROFILE_SAMPLED(PROFILE_MEM_READ, value = read_byte(address));
+  return value;
+}
+
+unsigned int __not_in_flash_func(__wrap_cpu_read_word)(unsigned int address) {
+  unsigned int value;
+  PROFILE_SAMPLED(PROFILE_MEM_READ, value = read_word(address));
+  return value;
+}
+
+unsigned int __not_in_flash_func(__wrap_cpu_read_long)(unsigned int address) {
+  unsigned int value;
+  PROFILE_SAMPLED(PROFILE_MEM_READ, value = read_long(address));
+  return value;
+}
+
+void mem_hooks_replay(const mem_io_shadow_t *shadow) {
+  // port directions and outputs first (this also sets the ROM overlay), then timers and interrupts
+  static const uint8_t via_order[] = {2, 3, 0, 15, 6, 7, 8, 11, 12};
+  for (unsigned int i = 0; i < sizeof(via_order); i++)
+    __wrap_cpu_write_byte(VIA_REG0 | via_order[i] << 9, shadow->via[via_order[i]]);
+  __wrap_cpu_write_byte(VIA_REG0 | 14 << 9, 0x7f);
+  __wrap_cpu_write_byte(VIA_REG0 | 14 << 9, 0x80 | shadow->via_ier);
+
+  for (int channel = 0; channel < 2; channel++) {
+    unsigned int control = channel ? SCC_CONTROL_A : SCC_CONTROL_B;
+    for (int reg = 1; reg < 16; reg++) {
+      if (reg == 8) continue; // transmit buffer
+      __wrap_cpu_write_byte(control, (reg & 7) | (reg & 8 ? 0x08 : 0));
+      __wrap_cpu_write_byte(control, shadow->scc[channel][reg]);
+    }
+  }
+}
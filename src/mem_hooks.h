@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+// Hooks on umac's memory accessors, linked in with -Wl,--wrap (see CMakeLists.txt),
+// with RAM and ROM pages reached directly at ram and rom
+void mem_hooks_init(unsigned int fb_offset, uint8_t *ram, const uint8_t *rom);
+
+// Last configuration written by the guest to the VIA and SCC, so that it can
+// be saved and written again to the fresh chips of a resumed machine
+typedef struct {
+  uint8_t via[16];
+  uint8_t via_ier;      // enabled interrupts, the register itself has set/clear semantics
+  uint8_t scc[2][16];   // write registers of channels B and A
+} mem_io_shadow_t;
+
+extern mem_io_shadow_t mem_io_shadow;
+void mem_hooks_replay(const mem_io_shadow_t *shadow);
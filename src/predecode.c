@@ -0,0 +1,211 @@
+/* Predecoded 68000 opcodes:
+ *
+ * Musashi's m68k_execute() fetches every opcode through umac's memory decoding
+ * (cpu_read_word()), then looks its handler and base cycles up in two 64K
+ * tables. predecode_execute() is the same loop with a direct-mapped cache in
+ * front, indexed by PC, holding the opcode, handler and cycles of the last
+ * instruction run at that address. Extension words are still read by the
+ * handlers themselves, as generated by Musashi.
+ *
+ * ROM code never changes while it is mapped; the whole cache is flushed when
+ * the VIA switches the boot overlay. RAM is split into 1K pages with a flag
+ * (cached code in there) and a generation stored in each entry: a write to a
+ * flagged page, by the guest through the wrapped cpu_write_*() or by a disc
+ * read, bumps its generation, which drops its entries at once.
+ *
+ * Needs Musashi's instruction hook and trace emulation off, as umac builds it.
+ */
+
+#include <string.h>
+
+#include "m68kcpu.h"
+
+#if PICO
+#include "pico.h"
+#else
+#define __not_in_flash_func(f) f
+#define __force_inline inline __attribute__((always_inline))
+#endif
+
+#include "predecode.h"
+
+#if M68K_INSTRUCTION_HOOK != OPT_OFF || M68K_EMULATE_TRACE != OPT_OFF
+#error "PREDECODE replaces m68k_execute(), which then needs the instruction hook and trace off"
+#endif
+
+#define ROM_END 0x500000
+#define NO_PC 1 // odd, never fetched
+
+typedef void (*handler_t)(void);
+
+typedef struct {
+  uint32_t pc;
+  handler_t handler;
+  uint16_t ir;
+  uint8_t cycles;
+  uint8_t generation;
+} entry_t;
+
+predecode_stats_t predecode_stats;
+uint8_t predecode_code_pages[PREDECODE_PAGES];
+
+static entry_t entries[PREDECODE_ENTRIES];
+static uint8_t generations[PREDECODE_PAGES];
+static uint8_t *ram_base;
+
+void predecode_init(uint8_t *ram) {
+  ram_base = ram;
+  predecode_flush();
+}
+
+void predecode_flush() {
+  for (int i = 0; i < PREDECODE_ENTRIES; i++) entries[i].pc = NO_PC;
+  memset(predecode_code_pages, 0, sizeof(predecode_code_pages));
+}
+
+static void invalidate_page(uint32_t page) {
+  if (!predecode_code_pages[page]) return;
+  predecode_code_pages[page] = 0;
+  predecode_stats.invalidations++;
+  // a wrapped generation could match an entry that old
+  if (++generations[page] == 0) predecode_flush();
+}
+
+void __not_in_flash_func(predecode_write_slow)(uint32_t address, unsigned int size) {
+  invalidate_page((address & (PREDECODE_RAM_SPAN - 1)) >> PREDECODE_PAGE_SHIFT);
+  invalidate_page(((address + size - 1) & (PREDECODE_RAM_SPAN - 1)) >> PREDECODE_PAGE_SHIFT);
+}
+
+static inline uint8_t generation_of(uint32_t pc) {
+  return pc < PREDECODE_RAM_END ? generations[(pc & (PREDECODE_RAM_SPAN - 1)) >> PREDECODE_PAGE_SHIFT] : 0;
+}
+
+static void __not_in_flash_func(fill)(entry_t *entry, uint32_t pc, handler_t handler, unsigned int cycles) {
+  predecode_stats.misses++;
+  if (pc >= ROM_END) return; // I/O space
+  if (pc < PREDECODE_RAM_END) predecode_code_pages[(pc & (PREDECODE_RAM_SPAN - 1)) >> PREDECODE_PAGE_SHIFT] = 1;
+  entry->pc = pc;
+  entry->ir = REG_IR;
+  entry->handler = handler;
+  entry->cycles = cycles;
+  entry->generation = generation_of(pc);
+}
+
+// the opcode fetch and dispatch of m68k_execute(), through the cache
+static __force_inline void predecode_dispatch() {
+  uint32_t pc = REG_PC;
+  entry_t *entry = &entries[(pc >> 1) & (PREDECODE_ENTRIES - 1)];
+  handler_t handler;
+  unsigned int cycles;
+  if (entry->pc == pc && entry->generation == generation_of(pc)) {
+    predecode_stats.hits++;
+    REG_IR = entry->ir;
+    REG_PC = pc + 2;
+    handler = entry->handler;
+    cycles = entry->cycles;
+  } else {
+    REG_IR = m68ki_read_imm_16();
+    handler = m68ki_instruction_jump_table[REG_IR];
+    cycles = CYC_INSTRUCTION[REG_IR];
+    fill(entry, pc, handler, cycles);
+  }
+  // the instruction may write over its own page, the entry is not used after this
+  handler();
+  USE_CYCLES(cycles);
+}
+
+// m68k_execute() from m68kcpu.c, statement for statement, with its three
+// fetch and dispatch statements replaced by predecode_dispatch(). The build
+// compares the two bodies, comments and layout aside, so keep it that way.
+int __not_in_flash_func(predecode_execute)(int num_cycles) {
+  /* eat up any reset cycles */
+  if (RESET_CYCLES) {
+    int rc = RESET_CYCLES;
+    RESET_CYCLES = 0;
+    num_cycles -= rc;
+    if (num_cycles <= 0)
+      return rc;
+  }
+
+  /* Set our pool of clock cycles available */
+  SET_CYCLES(num_cycles);
+  m68ki_initial_cycles = num_cycles;
+
+  /* See if interrupts came in */
+  m68ki_check_interrupts();
+
+  /* Make sure we're not stopped */
+  if (!CPU_STOPPED) {
+    /* Return point if we had an address error */
+    m68ki_set_address_error_trap(); /* auto-disable (see m68kcpu.h) */
+
+    m68ki_check_bus_error_trap();
+
+    /* Main loop.  Keep going until we run out of clock cycles */
+    do {
+      int i;
+      /* Set tracing accodring to T1. (T0 is done inside instruction) */
+      m68ki_trace_t1(); /* auto-disable (see m68kcpu.h) */
+
+      /* Set the address space for reads */
+      m68ki_use_data_space(); /* auto-disable (see m68kcpu.h) */
+
+      /* Call external hook to peek at CPU */
+      m68ki_instr_hook(REG_PC); /* auto-disable (see m68kcpu.h) */
+
+      /* Record previous program counter */
+      REG_PPC = REG_PC;
+
+      /* Record previous D/A register state (in case of bus error) */
+      for (i = 15; i >= 0; i--) {
+        REG_DA_SAVE[i] = REG_DA[i];
+      }
+
+      /* Read an instruction and call its handler */
+      predecode_dispatch();
+
+      /* Trace m68k_exception, if necessary */
+      m68ki_exception_if_trace(); /* auto-disable (see m68kcpu.h) */
+    } while (GET_CYCLES() > 0);
+
+    /* set previous PC to current PC for the next entry into the loop */
+    REG_PPC = REG_PC;
+  } else
+    SET_CYCLES(0);
+
+  /* return how many clocks we used */
+  return m68ki_initial_cycles - GET_CYCLES();
+}
+
+typedef int (*disc_op_t)(void *ctx, uint8_t *data, unsigned int offset, unsigned int len);
+
+typedef struct {
+  void *ctx;
+  disc_op_t read;
+  disc_op_t write;
+} backend_t;
+
+static backend_t backends[DISC_NUM_DRIVES];
+
+static int predecode_disc_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  backend_t *backend = ctx;
+  int result = backend->read(backend->ctx, data, offset, len);
+  if (data >= ram_base && data < ram_base + RAM_SIZE) {
+    uint32_t address = data - ram_base;
+    for (uint32_t page = address >> PREDECODE_PAGE_SHIFT; page <= (address + len - 1) >> PREDECODE_PAGE_SHIFT; page++)
+      invalidate_page(page & (PREDECODE_PAGES - 1));
+  }
+  return result;
+}
+
+static int predecode_disc_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  backend_t *backend = ctx;
+  return backend->write(backend->ctx, data, offset, len);
+}
+
+void predecode_disc_attach(disc_descr_t *disc, int drive) {
+  backends[drive] = (backend_t) {disc->op_ctx, disc->op_read, disc->op_write};
+  disc->op_ctx = &backends[drive];
+  disc->op_read = predecode_disc_read;
+  if (disc->op_write) disc->op_write = predecode_disc_write;
+}
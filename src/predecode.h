@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "umac.h"
+
+// Predecoded opcodes, with -DPREDECODE=ON: the opcode, handler and base
+// cycles of instructions already run are kept per guest PC, for ROM and RAM
+// code, so that the 68000 loop skips the opcode fetch and the table lookups.
+// Entries of a RAM page are dropped when the guest (or a disc read) writes it.
+#ifndef PREDECODE_ENTRIES
+#define PREDECODE_ENTRIES 1024  // a power of two, 12 bytes each
+#endif
+#define PREDECODE_PAGE_SHIFT 10
+
+typedef struct {
+  uint32_t hits;
+  uint32_t misses;        // opcodes fetched from guest memory
+  uint32_t invalidations; // pages of cached code written
+} predecode_stats_t;
+
+extern predecode_stats_t predecode_stats;
+
+// ram is the Mac's memory, for disc reads landing in it
+void predecode_init(uint8_t *ram);
+// Replaces m68k_execute(), same contract
+int predecode_execute(int num_cycles);
+// Drop everything, when the ROM overlay changes what is at address 0
+void predecode_flush();
+// Drop what is cached of the pages written, size bytes at address
+void predecode_write_slow(uint32_t address, unsigned int size);
+// Drop what disc reads into the Mac's memory overwrite
+void predecode_disc_attach(disc_descr_t *disc, int drive);
+
+#define PREDECODE_RAM_END 0x400000
+// RAM is mirrored up to 4M: pages are folded to the smallest power of two holding it
+#define PREDECODE_RAM_SPAN (RAM_SIZE <= 0x20000 ? 0x20000 : RAM_SIZE <= 0x40000 ? 0x40000 : \
+                            RAM_SIZE <= 0x80000 ? 0x80000 : RAM_SIZE <= 0x100000 ? 0x100000 : \
+                            RAM_SIZE <= 0x200000 ? 0x200000 : 0x400000)
+#define PREDECODE_PAGES (PREDECODE_RAM_SPAN >> PREDECODE_PAGE_SHIFT)
+
+extern uint8_t predecode_code_pages[PREDECODE_PAGES];
+
+// Called on every guest write: one load when the page holds no cached code
+static inline void predecode_write(uint32_t address, unsigned int size) {
+  if (address >= PREDECODE_RAM_END) return;
+  uint32_t first = (address & (PREDECODE_RAM_SPAN - 1)) >> PREDECODE_PAGE_SHIFT;
+  uint32_t last = ((address + size - 1) & (PREDECODE_RAM_SPAN - 1)) >> PREDECODE_PAGE_SHIFT;
+  if (predecode_code_pages[first] | predecode_code_pages[last]) predecode_write_slow(address, size);
+}
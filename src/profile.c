@@ -0,0 +1,171 @@
+/* Emulator profiler:
+ *
+ * With -DUMAC_PROFILE=ON, core 1 brackets the regions listed in profile.h
+ * (umac_loop(), m68k_execute(), memory accessors, events, disc ops) with
+ * SysTick reads and keeps a stack of the open ones, so that each region gets
+ * its inclusive time and its exclusive time, the inner regions taken out.
+ * Memory accessors run millions of times a second: only one call in
+ * 2^PROFILE_SAMPLE_SHIFT is timed and counts for all of them. The cost of an
+ * empty region is measured at init and taken out of every timing. It is also
+ * used, with the measured cost of an access that is not timed, to estimate the
+ * overhead printed with the table; bench-profile in tools/check.sh checks
+ * that estimate against a host build without UMAC_PROFILE.
+ *
+ * The table is printed by core 0 on ctrl-alt-F7 (and every
+ * PROFILE_DUMP_SECONDS if set), for what was counted since the last one.
+ * This file also builds on a host, see tools/umac-profile.c.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "profile.h"
+
+#if PICO
+#include "pico/time.h"
+#endif
+
+#define CALIBRATION_RUNS 256
+#define SAMPLE_CALIBRATION_RUNS 4096
+
+profile_count_t profile_counts[PROFILE_REGIONS];
+uint32_t profile_countdown[PROFILE_REGIONS];
+profile_frame_t profile_stack[PROFILE_DEPTH];
+int profile_depth = 0;
+uint32_t profile_bias = 0;
+
+static uint32_t pair_cost = 0;   // a whole empty region, timing included, in ticks
+static uint32_t sample_cost = 0; // SAMPLE_CALIBRATION_RUNS accesses not timed, in ticks
+static volatile int dump_requested = 0;
+static profile_count_t last[PROFILE_REGIONS];
+
+static const char *names[PROFILE_REGIONS] = {
+  "umac_loop", "m68k_execute", "memory reads", "memory writes",
+  "events", "vsync event", "1Hz event", "disc ops", "throttle",
+};
+
+void profile_init() {
+#if PICO
+  systick_hw->rvr = PROFILE_TICK_MASK;
+  systick_hw->cvr = 0;
+  systick_hw->csr = 0x5; // enabled, processor clock, no interrupt
+#endif
+  // inner: what the clock reads of an empty region, outer: what the region really costs
+  profile_begin();
+  for (int i = 0; i < CALIBRATION_RUNS; i++) {
+    profile_begin();
+    profile_end(PROFILE_LOOP, 0);
+  }
+  profile_end(PROFILE_EXECUTE, 0);
+  profile_bias = profile_counts[PROFILE_LOOP].inclusive / CALIBRATION_RUNS;
+  pair_cost = profile_counts[PROFILE_EXECUTE].inclusive / CALIBRATION_RUNS;
+
+  // the countdown of sampled regions, kept from taking the timed branch, less the same loop without it
+  profile_countdown[PROFILE_MEM_READ] = 0;
+  uint32_t start = profile_now();
+  for (int i = 0; i < SAMPLE_CALIBRATION_RUNS; i++) {
+    profile_sample(PROFILE_MEM_READ);
+    __asm volatile("" ::: "memory");
+  }
+  uint32_t sampled = (profile_now() - start) & PROFILE_TICK_MASK;
+  start = profile_now();
+  for (int i = 0; i < SAMPLE_CALIBRATION_RUNS; i++) __asm volatile("" ::: "memory");
+  uint32_t empty = (profile_now() - start) & PROFILE_TICK_MASK;
+  sample_cost = sampled > empty ? sampled - empty : 0;
+
+  memset(profile_counts, 0, sizeof(profile_counts));
+  for (int i = 0; i < PROFILE_REGIONS; i++) profile_countdown[i] = 1;
+}
+
+typedef int (*disc_op_t)(void *ctx, uint8_t *data, unsigned int offset, unsigned int len);
+
+typedef struct {
+  void *ctx;
+  disc_op_t read;
+  disc_op_t write;
+} backend_t;
+
+static backend_t backends[DISC_NUM_DRIVES];
+
+static int profile_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  backend_t *backend = ctx;
+  PROFILE_BEGIN(PROFILE_DISC);
+  int result = backend->read(backend->ctx, data, offset, len);
+  PROFILE_END(PROFILE_DISC);
+  return result;
+}
+
+static int profile_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  backend_t *backend = ctx;
+  PROFILE_BEGIN(PROFILE_DISC);
+  int result = backend->write(backend->ctx, data, offset, len);
+  PROFILE_END(PROFILE_DISC);
+  return result;
+}
+
+void profile_disc_attach(disc_descr_t *disc, int drive) {
+  backends[drive] = (backend_t) {disc->op_ctx, disc->op_read, disc->op_write};
+  disc->op_ctx = &backends[drive];
+  disc->op_read = profile_read;
+  if (disc->op_write) disc->op_write = profile_write;
+}
+
+void profile_dump() {
+  profile_count_t delta[PROFILE_REGIONS];
+  int order[PROFILE_REGIONS];
+  uint64_t total = 0, timed = 0, untimed = 0;
+  for (int i = 0; i < PROFILE_REGIONS; i++) {
+    profile_count_t now = profile_counts[i]; // core 1 keeps counting, a torn value only skews one dump
+    delta[i] = (profile_count_t) {now.inclusive - last[i].inclusive, now.exclusive - last[i].exclusive,
+                                  now.calls - last[i].calls};
+    last[i] = now;
+    total += delta[i].exclusive;
+    if (i == PROFILE_MEM_READ || i == PROFILE_MEM_WRITE) {
+      timed += delta[i].calls >> PROFILE_SAMPLE_SHIFT;
+      untimed += delta[i].calls - (delta[i].calls >> PROFILE_SAMPLE_SHIFT);
+    } else {
+      timed += delta[i].calls;
+    }
+    order[i] = i;
+  }
+  for (int i = 1; i < PROFILE_REGIONS; i++) {
+    for (int j = i; j > 0 && delta[order[j]].exclusive > delta[order[j - 1]].exclusive; j--) {
+      int swap = order[j];
+      order[j] = order[j - 1];
+      order[j - 1] = swap;
+    }
+  }
+  if (!total) total = 1;
+
+  uint64_t timing = timed * pair_cost * 1000 / total;
+  uint64_t sampling = untimed * sample_cost * 1000 / SAMPLE_CALIBRATION_RUNS / total;
+  printf("profile: %llu ticks, overhead ~%u.%u%% (timing %u.%u%%, sampling %u.%u%%)\n", (unsigned long long) total,
+         (unsigned) ((timing + sampling) / 10), (unsigned) ((timing + sampling) % 10),
+         (unsigned) (timing / 10), (unsigned) (timing % 10), (unsigned) (sampling / 10), (unsigned) (sampling % 10));
+  printf("%-14s %10s %7s %7s %10s\n", "region", "calls", "incl%", "excl%", "excl/call");
+  for (int i = 0; i < PROFILE_REGIONS; i++) {
+    profile_count_t *count = &delta[order[i]];
+    if (!count->calls) continue;
+    printf("%-14s %10lu %6u%% %6u%% %10llu\n", names[order[i]], (unsigned long) count->calls,
+           (unsigned) (count->inclusive * 100 / total), (unsigned) (count->exclusive * 100 / total),
+           (unsigned long long) (count->exclusive / count->calls));
+  }
+}
+
+void profile_request_dump() {
+  dump_requested = 1;
+}
+
+void profile_task() {
+#if PICO && PROFILE_DUMP_SECONDS
+  static uint64_t last_dump_us = 0;
+  uint64_t now = time_us_64();
+  if (now - last_dump_us >= PROFILE_DUMP_SECONDS * 1000000ull) {
+    last_dump_us = now;
+    dump_requested = 1;
+  }
+#endif
+  if (!dump_requested) return;
+  dump_requested = 0;
+  profile_dump();
+}
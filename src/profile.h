@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "umac.h"
+
+// Core 1 time per region of the emulator, with -DUMAC_PROFILE=ON: inclusive
+// and exclusive (children taken out) cycles, read from SysTick (a monotonic
+// clock in host builds), so a single region must last less than 2^24 cycles.
+// Without it, the macros below compile to nothing.
+
+typedef enum {
+  PROFILE_LOOP,       // umac_loop()
+  PROFILE_EXECUTE,    // Musashi's m68k_execute()
+  PROFILE_MEM_READ,   // umac's cpu_read_*(), 1 in 2^PROFILE_SAMPLE_SHIFT timed
+  PROFILE_MEM_WRITE,  // umac's cpu_write_*(), the same
+  PROFILE_EVENTS,     // due scheduler events
+  PROFILE_VSYNC,      // umac_vsync_event(): VIA and SCC ticks, interrupts
+  PROFILE_1HZ,        // umac_1hz_event()
+  PROFILE_DISC,       // disc ops called by umac
+  PROFILE_THROTTLE,   // governor sleeping
+  PROFILE_REGIONS
+} profile_region_t;
+
+// Memory accesses are too frequent to time them all
+#ifndef PROFILE_SAMPLE_SHIFT
+#define PROFILE_SAMPLE_SHIFT 6
+#endif
+// Dump every that many seconds as well (0: only on ctrl-alt-F7)
+#ifndef PROFILE_DUMP_SECONDS
+#define PROFILE_DUMP_SECONDS 0
+#endif
+#define PROFILE_DEPTH 8
+
+#if UMAC_PROFILE
+
+#if PICO
+#include "hardware/structs/systick.h"
+#define PROFILE_TICK_MASK 0xffffff  // SysTick counts down over 24 bits, at the CPU clock
+static inline uint32_t profile_now() {
+  return ~systick_hw->cvr;
+}
+#else
+#include <time.h>
+#define PROFILE_TICK_MASK 0xffffffff // nanoseconds
+static inline uint32_t profile_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t) (ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+#endif
+
+typedef struct {
+  uint64_t inclusive;
+  uint64_t exclusive;
+  uint32_t calls;
+} profile_count_t;
+
+typedef struct {
+  uint32_t start;
+  uint32_t children;  // time of the regions entered from this one
+} profile_frame_t;
+
+extern profile_count_t profile_counts[PROFILE_REGIONS];
+extern uint32_t profile_countdown[PROFILE_REGIONS];
+extern profile_frame_t profile_stack[PROFILE_DEPTH];
+extern int profile_depth;
+extern uint32_t profile_bias;
+
+static inline void profile_begin() {
+  profile_frame_t *frame = &profile_stack[profile_depth++];
+  frame->children = 0;
+  frame->start = profile_now();
+}
+
+// A sampled region counts for 2^shift runs
+static inline void profile_end(profile_region_t region, int shift) {
+  uint32_t elapsed = (profile_now() - profile_stack[--profile_depth].start) & PROFILE_TICK_MASK;
+  elapsed = elapsed > profile_bias ? elapsed - profile_bias : 0;
+  profile_count_t *count = &profile_counts[region];
+  uint64_t scaled = (uint64_t) elapsed << shift;
+  uint64_t children = (uint64_t) profile_stack[profile_depth].children << shift;
+  count->inclusive += scaled;
+  count->exclusive += scaled > children ? scaled - children : 0; // sampled children are estimates
+  if (!shift) count->calls++;
+  if (profile_depth) profile_stack[profile_depth - 1].children += scaled;
+}
+
+// Accesses not timed only pay for a decrement and a branch
+static inline int profile_sample(profile_region_t region) {
+  if (--profile_countdown[region]) return 0;
+  profile_countdown[region] = 1 << PROFILE_SAMPLE_SHIFT;
+  profile_counts[region].calls += 1 << PROFILE_SAMPLE_SHIFT;
+  return 1;
+}
+
+#define PROFILE_BEGIN(region) profile_begin()
+#define PROFILE_END(region) profile_end(region, 0)
+#define PROFILE_SAMPLED(region, statement) \
+  do { \
+    if (profile_sample(region)) { \
+      profile_begin(); \
+      statement; \
+      profile_end(region, PROFILE_SAMPLE_SHIFT); \
+    } else { \
+      statement; \
+    } \
+  } while (0)
+
+// Core 1: start the counter and measure what timing an empty region costs
+void profile_init();
+// Time a drive's disc ops
+void profile_disc_attach(disc_descr_t *disc, int drive);
+// Ask for a dump from any core, done by profile_task()
+void profile_request_dump();
+// Core 0: print what was counted since the last dump, sorted by exclusive time
+void profile_task();
+// Print now, from the core that was profiled (host builds)
+void profile_dump();
+
+#else
+
+#define PROFILE_BEGIN(region) do { } while (0)
+#define PROFILE_END(region) do { } while (0)
+#define PROFILE_SAMPLED(region, statement) do { statement; } while (0)
+
+static inline void profile_init() {}
+static inline void profile_disc_attach(disc_descr_t *disc, int drive) { (void) disc; (void) drive; }
+static inline void profile_request_dump() {}
+static inline void profile_task() {}
+
+#endif
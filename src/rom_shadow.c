@@ -0,0 +1,60 @@
+/* ROM shadow:
+ *
+ * The patched ROM is a const array, so every 68000 fetch from it is an XIP
+ * access, served by a 16K cache that the 128K ROM does not fit in. On RP2350
+ * the SRAM left after a Mac memory below 384K holds it. The copy is taken
+ * from the heap at boot, sized against what the heap can still grow into:
+ * pico_malloc panics rather than returning NULL, so the free space is
+ * worked out from the linker's heap bounds and mallinfo() before asking.
+ * Both copies are read at boot and the speedup is printed.
+ */
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/time.h"
+
+#include "rom_shadow.h"
+
+#define TIMING_PASSES 4
+
+// Heap bounds from the pico-sdk linker script, _sbrk grows from one to the other
+extern char __end__, __StackLimit;
+
+// Bytes malloc can still hand out: the unclaimed part of the heap plus
+// whatever has been freed back to it
+static unsigned int heap_free(void) {
+  struct mallinfo info = mallinfo();
+  return (unsigned int) (&__StackLimit - &__end__) - info.arena + info.fordblks;
+}
+
+// Sums the ROM a word at a time, as instruction fetches would go through it
+static uint32_t time_reads(const uint8_t *rom, unsigned int size) {
+  const volatile uint32_t *words = (const volatile uint32_t *) rom;
+  uint32_t sum = 0;
+  uint64_t start = time_us_64();
+  for (int pass = 0; pass < TIMING_PASSES; pass++)
+    for (unsigned int i = 0; i < size / 4; i++) sum += words[i];
+  uint32_t elapsed = time_us_64() - start;
+  (void) sum;
+  return elapsed ? elapsed : 1;
+}
+
+const uint8_t *rom_shadow(const uint8_t *rom, unsigned int size) {
+  unsigned int heap = heap_free();
+  uint8_t *copy = NULL;
+  if (heap >= size + ROM_SHADOW_RESERVE_KB * 1024) copy = malloc(size);
+  if (!copy) {
+    printf("ROM in flash: no room for a %uK copy in SRAM (%uK heap free)\n", size / 1024, heap / 1024);
+    return rom;
+  }
+  memcpy(copy, rom, size);
+
+  uint32_t flash_us = time_reads(rom, size);
+  uint32_t sram_us = time_reads(copy, size);
+  printf("ROM in SRAM: %uK, reads %lu.%02lux faster than from flash (%lu us vs %lu us)\n", size / 1024,
+         flash_us / sram_us, flash_us * 100 / sram_us % 100, sram_us, flash_us);
+  return copy;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+// Copy of the Mac ROM in SRAM, on RP2350 builds with ROM_SHADOW: umac then
+// fetches ROM code and Toolbox traps from SRAM rather than through the flash
+// cache. Left out when the heap, after the Mac's memory, cannot hold it with
+// ROM_SHADOW_RESERVE_KB to spare.
+#ifndef ROM_SHADOW_RESERVE_KB
+#define ROM_SHADOW_RESERVE_KB 16
+#endif
+
+// Returns the copy, or rom itself when it does not fit
+const uint8_t *rom_shadow(const uint8_t *rom, unsigned int size);
@@ -0,0 +1,72 @@
+/* Emulated-time scheduler:
+ *
+ * Periodic events (vsync, the 1 Hz tick, input delivery) are due at a cycle
+ * count rather than a wall-clock time, so guest timing does not depend on how
+ * fast core 1 happens to run. umac's m68k_execute() is wrapped at link time
+ * (-Wl,--wrap) to count the cycles actually executed and to end each quantum
+ * on the next deadline.
+ */
+
+#include "pico.h"
+
+#include "sched.h"
+#include "profile.h"
+#if PREDECODE
+#include "predecode.h"
+#endif
+
+#define SCHED_MAX_EVENTS 8
+
+int __real_m68k_execute(int num_cycles);
+
+typedef struct {
+  sched_handler_t handler;
+  uint32_t period;
+  uint64_t due;
+} sched_event_t;
+
+static sched_event_t events[SCHED_MAX_EVENTS];
+static int event_count = 0;
+
+uint64_t sched_now = 0;
+uint64_t sched_next = UINT64_MAX;
+
+static void sched_update_next() {
+  sched_next = UINT64_MAX;
+  for (int i = 0; i < event_count; i++)
+    if (events[i].due < sched_next) sched_next = events[i].due;
+}
+
+void sched_add(sched_handler_t handler, uint32_t period) {
+  if (event_count == SCHED_MAX_EVENTS) return;
+  events[event_count++] = (sched_event_t) {handler, period, sched_now + period};
+  sched_update_next();
+}
+
+void __not_in_flash_func(sched_run_due)() {
+  PROFILE_BEGIN(PROFILE_EVENTS);
+  for (int i = 0; i < event_count; i++) {
+    if (events[i].due <= sched_now) {
+      events[i].due += events[i].period; // from the deadline, not from now, so nothing drifts
+      events[i].handler();
+    }
+  }
+  sched_update_next();
+  PROFILE_END(PROFILE_EVENTS);
+}
+
+int __not_in_flash_func(__wrap_m68k_execute)(int num_cycles) {
+  (void) num_cycles; // umac's own quantum, replaced by ours
+  uint64_t budget = sched_next - sched_now;
+  int cycles = budget < UMAC_LOOP_CYCLES ? (int) budget : UMAC_LOOP_CYCLES;
+  if (cycles < 1) cycles = 1;
+  PROFILE_BEGIN(PROFILE_EXECUTE);
+#if PREDECODE
+  int used = predecode_execute(cycles);
+#else
+  int used = __real_m68k_execute(cycles);
+#endif
+  PROFILE_END(PROFILE_EXECUTE);
+  sched_now += used;
+  return used;
+}
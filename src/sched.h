@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+// Emulated time, counted in executed 68000 cycles rather than read from a clock
+#define SCHED_CPU_HZ 7833600
+#define SCHED_VSYNC_CYCLES (370 * 352) // 370 lines of 704 dots at twice the CPU clock, 60.15 Hz
+
+// Longest run of m68k_execute() between two checks of the event table
+#ifndef UMAC_LOOP_CYCLES
+#define UMAC_LOOP_CYCLES 10000
+#endif
+
+typedef void (*sched_handler_t)(void);
+
+extern uint64_t sched_now;
+extern uint64_t sched_next;
+
+// Call handler every period cycles, starting one period from now
+void sched_add(sched_handler_t handler, uint32_t period);
+void sched_run_due();
+
+// Cheap enough for every umac_loop() iteration: one compare against the cached deadline
+static inline void sched_poll() {
+  if (sched_now >= sched_next) sched_run_due();
+}
@@ -0,0 +1,437 @@
+/* NCR 5380 SCSI controller and disks:
+ *
+ * The guest drives the bus through the 5380 registers: arbitration and
+ * selection, then every byte of a phase handshaked with REQ/ACK, either by
+ * hand through the initiator command register or with pseudo-DMA, where
+ * accesses to the DACK addresses move one byte each. The target side answers
+ * at once: REQ is up whenever a byte is due and ACK (or a DACK access) moves
+ * to the next byte or phase.
+ *
+ * Disks are direct access devices with 512-byte blocks. Read and write
+ * commands go to the disc ops SCSI_BUF_SECTORS sectors at a time, so that a
+ * large transfer costs a few multi-block card accesses.
+ */
+
+#include <string.h>
+
+#include "scsi.h"
+#include "log.h"
+
+#define SECTOR_SIZE 512
+
+// Register numbers, read / write
+#define REG_DATA 0      // current data / output data
+#define REG_ICR 1       // initiator command
+#define REG_MODE 2
+#define REG_TCR 3       // target command
+#define REG_BUS 4       // current bus status / select enable
+#define REG_BAS 5       // bus and status / start DMA send
+#define REG_INPUT 6     // input data / start DMA target receive
+#define REG_RESET 7     // reset parity and interrupt / start DMA initiator receive
+
+#define ICR_DATA 0x01
+#define ICR_ATN 0x02
+#define ICR_SEL 0x04
+#define ICR_BSY 0x08
+#define ICR_ACK 0x10
+#define ICR_AIP 0x40
+#define ICR_RST 0x80
+
+#define MODE_ARB 0x01
+#define MODE_DMA 0x02
+
+#define BUS_SEL 0x02
+#define BUS_REQ 0x20
+#define BUS_BSY 0x40
+
+#define BAS_ACK 0x01
+#define BAS_ATN 0x02
+#define BAS_PHASE_MATCH 0x08
+#define BAS_DRQ 0x40
+#define BAS_END_DMA 0x80
+
+// Phases, as I/O, C/D and MSG in the target command register (bus status has them 2 bits up)
+#define PH_IO 1
+#define PH_CD 2
+#define PH_MSG 4
+#define PHASE_DATA_OUT 0
+#define PHASE_DATA_IN PH_IO
+#define PHASE_COMMAND PH_CD
+#define PHASE_STATUS (PH_CD | PH_IO)
+#define PHASE_MSG_OUT (PH_MSG | PH_CD)
+#define PHASE_MSG_IN (PH_MSG | PH_CD | PH_IO)
+
+#define STATUS_GOOD 0x00
+#define STATUS_CHECK 0x02
+
+#define SENSE_NONE 0x0
+#define SENSE_MEDIUM_ERROR 0x3
+#define SENSE_ILLEGAL_REQUEST 0x5
+
+typedef struct {
+  disc_descr_t disc;
+  uint32_t blocks;
+  uint8_t sense_key;
+  uint8_t sense_code;
+} scsi_disk_t;
+
+static scsi_disk_t disks[SCSI_NUM_TARGETS];
+
+// controller
+static uint8_t out_data, icr, mode, tcr;
+
+// bus, as seen from the target
+static int target = -1;       // selected disk, -1 when the bus is free
+static int selecting;         // BSY answered, waiting for SEL to go
+static uint8_t phase;
+static int req;
+
+// current command
+static uint8_t cmd[12];
+static unsigned int cmd_len, cmd_pos;
+static uint8_t status;
+static int writing;           // data out goes to the disc
+static uint32_t lba, blocks_left;
+static uint8_t buf[SCSI_BUF_SECTORS * SECTOR_SIZE] __attribute__((aligned(4)));
+static unsigned int xfer_len, xfer_pos;
+
+void scsi_attach(int id, disc_descr_t *disc) {
+  disks[id].disc = *disc;
+  disks[id].blocks = disc->size / SECTOR_SIZE;
+}
+
+static void enter(uint8_t p) {
+  phase = p;
+  req = 1;
+}
+
+static void finish(uint8_t st, uint8_t key, uint8_t code) {
+  disks[target].sense_key = key;
+  disks[target].sense_code = code;
+  status = st;
+  enter(PHASE_STATUS);
+}
+
+static void data_in(unsigned int len, unsigned int max) {
+  xfer_len = len < max ? len : max;
+  xfer_pos = 0;
+  if (xfer_len) enter(PHASE_DATA_IN);
+  else finish(STATUS_GOOD, SENSE_NONE, 0);
+}
+
+static void data_out(unsigned int len) {
+  xfer_len = len;
+  xfer_pos = 0;
+  if (xfer_len) enter(PHASE_DATA_OUT);
+  else finish(STATUS_GOOD, SENSE_NONE, 0);
+}
+
+// next part of a read, or the status once all blocks are sent
+static void read_chunk() {
+  scsi_disk_t *d = &disks[target];
+  if (!blocks_left) {
+    finish(STATUS_GOOD, SENSE_NONE, 0);
+    return;
+  }
+  unsigned int n = blocks_left < SCSI_BUF_SECTORS ? blocks_left : SCSI_BUF_SECTORS;
+  if (d->disc.op_read(d->disc.op_ctx, buf, lba * SECTOR_SIZE, n * SECTOR_SIZE) != 0) {
+    finish(STATUS_CHECK, SENSE_MEDIUM_ERROR, 0x11); // unrecovered read error
+    return;
+  }
+  lba += n;
+  blocks_left -= n;
+  data_in(n * SECTOR_SIZE, n * SECTOR_SIZE);
+}
+
+static void write_chunk() {
+  unsigned int n = blocks_left < SCSI_BUF_SECTORS ? blocks_left : SCSI_BUF_SECTORS;
+  data_out(n * SECTOR_SIZE);
+}
+
+// a whole buffer of write data has come in
+static void write_done() {
+  scsi_disk_t *d = &disks[target];
+  unsigned int n = xfer_len / SECTOR_SIZE;
+  if (d->disc.op_write(d->disc.op_ctx, buf, lba * SECTOR_SIZE, n * SECTOR_SIZE) != 0) {
+    finish(STATUS_CHECK, SENSE_MEDIUM_ERROR, 0x0c); // write error
+    return;
+  }
+  lba += n;
+  blocks_left -= n;
+  write_chunk();
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+// mode pages describing a made up geometry of 16 heads and 63 sectors per track
+static unsigned int mode_pages(uint8_t *p, int page, uint32_t blocks) {
+  unsigned int len = 0;
+  if (page == 0x03 || page == 0x3f) { // format device
+    memset(p + len, 0, 24);
+    p[len] = 0x03;
+    p[len + 1] = 22;
+    p[len + 3] = 16;      // tracks per zone
+    p[len + 11] = 63;     // sectors per track
+    p[len + 12] = SECTOR_SIZE >> 8;
+    p[len + 15] = 1;      // interleave
+    p[len + 20] = 0x40;   // hard sectored
+    len += 24;
+  }
+  if (page == 0x04 || page == 0x3f) { // rigid disk geometry
+    uint32_t cylinders = blocks / (16 * 63) + 1;
+    memset(p + len, 0, 24);
+    p[len] = 0x04;
+    p[len + 1] = 22;
+    p[len + 2] = cylinders >> 16;
+    p[len + 3] = cylinders >> 8;
+    p[len + 4] = cylinders;
+    p[len + 5] = 16;
+    len += 24;
+  }
+  return len;
+}
+
+static void execute() {
+  scsi_disk_t *d = &disks[target];
+  writing = 0;
+  switch (cmd[0]) {
+    case 0x00: // test unit ready
+    case 0x04: // format unit, blocks are always there
+    case 0x0b: // seek
+    case 0x1b: // start stop unit
+    case 0x1e: // prevent allow medium removal
+    case 0x2f: // verify
+    case 0x35: // synchronize cache
+      finish(STATUS_GOOD, SENSE_NONE, 0);
+      break;
+    case 0x03: { // request sense
+      memset(buf, 0, 18);
+      buf[0] = 0x70;
+      buf[2] = d->sense_key;
+      buf[7] = 10;
+      buf[12] = d->sense_code;
+      d->sense_key = SENSE_NONE;
+      d->sense_code = 0;
+      data_in(cmd[4] ? cmd[4] : 4, 18);
+      break;
+    }
+    case 0x12: // inquiry
+      memset(buf, 0, 36);
+      buf[2] = 1;  // SCSI-1 with CCS
+      buf[3] = 1;
+      buf[4] = 31;
+      memcpy(buf + 8, "UMAC    PicoCalc SD disk1.0 ", 28);
+      data_in(cmd[4], 36);
+      break;
+    case 0x1a: { // mode sense (6)
+      unsigned int len = 4;
+      memset(buf, 0, 12);
+      if (!(cmd[1] & 0x08)) { // block descriptor
+        buf[3] = 8;
+        put32(buf + 4, d->blocks);
+        put32(buf + 8, SECTOR_SIZE);
+        len += 8;
+      }
+      len += mode_pages(buf + len, cmd[2] & 0x3f, d->blocks);
+      buf[0] = len - 1;
+      data_in(cmd[4], len);
+      break;
+    }
+    case 0x15: // mode select (6), accepted and ignored
+      data_out(cmd[4]);
+      break;
+    case 0x25: // read capacity
+      put32(buf, d->blocks - 1);
+      put32(buf + 4, SECTOR_SIZE);
+      data_in(8, 8);
+      break;
+    case 0x08: // read (6)
+    case 0x0a: // write (6)
+    case 0x28: // read (10)
+    case 0x2a: // write (10)
+      if (cmd[0] & 0x20) {
+        lba = (uint32_t)cmd[2] << 24 | cmd[3] << 16 | cmd[4] << 8 | cmd[5];
+        blocks_left = cmd[7] << 8 | cmd[8];
+      } else {
+        lba = (cmd[1] & 0x1f) << 16 | cmd[2] << 8 | cmd[3];
+        blocks_left = cmd[4] ? cmd[4] : 256;
+      }
+      if (lba >= d->blocks || blocks_left > d->blocks - lba) {
+        finish(STATUS_CHECK, SENSE_ILLEGAL_REQUEST, 0x21); // lba out of range
+      } else if (cmd[0] & 0x02) {
+        writing = 1;
+        if (blocks_left) write_chunk();
+        else finish(STATUS_GOOD, SENSE_NONE, 0);
+      } else {
+        read_chunk();
+      }
+      break;
+    default:
+      LOG_DEBUG("scsi: unsupported command %02x\n", cmd[0]);
+      finish(STATUS_CHECK, SENSE_ILLEGAL_REQUEST, 0x20); // invalid command
+      break;
+  }
+}
+
+static int dma_ready() {
+  return mode & MODE_DMA && target >= 0 && !selecting && (tcr & 7) == phase;
+}
+
+// the byte the target puts on the bus in the current (input) phase
+static uint8_t bus_byte() {
+  if (target < 0 || selecting) return out_data;
+  switch (phase) {
+    case PHASE_DATA_IN: return buf[xfer_pos];
+    case PHASE_STATUS: return status;
+    case PHASE_MSG_IN: return 0; // command complete
+    default: return out_data;
+  }
+}
+
+// one handshake, value being the initiator's byte in output phases
+static void transfer(uint8_t value) {
+  if (target < 0 || selecting) return;
+  switch (phase) {
+    case PHASE_MSG_OUT: // identify and the like, nothing to act on
+      if (!(icr & ICR_ATN)) enter(PHASE_COMMAND);
+      break;
+    case PHASE_COMMAND:
+      if (cmd_pos == 0) {
+        int group = value >> 5;
+        cmd_len = group == 0 ? 6 : group == 5 ? 12 : 10;
+      }
+      cmd[cmd_pos++] = value;
+      if (cmd_pos == cmd_len) {
+        cmd_pos = 0;
+        execute();
+      }
+      break;
+    case PHASE_DATA_IN:
+      if (++xfer_pos < xfer_len) break;
+      if (cmd[0] == 0x08 || cmd[0] == 0x28) read_chunk();
+      else finish(STATUS_GOOD, SENSE_NONE, 0);
+      break;
+    case PHASE_DATA_OUT:
+      buf[xfer_pos] = value;
+      if (++xfer_pos < xfer_len) break;
+      if (writing) write_done();
+      else finish(STATUS_GOOD, SENSE_NONE, 0);
+      break;
+    case PHASE_STATUS:
+      enter(PHASE_MSG_IN);
+      break;
+    case PHASE_MSG_IN:
+      target = -1; // bus free
+      break;
+  }
+}
+
+// a target whose ID is on the bus answers SEL once the initiator has let go of BSY
+static void check_selection() {
+  if (target >= 0) {
+    if (selecting && !(icr & ICR_SEL)) {
+      selecting = 0;
+      cmd_pos = 0;
+      enter(icr & ICR_ATN ? PHASE_MSG_OUT : PHASE_COMMAND);
+    }
+    return;
+  }
+  if ((icr & (ICR_SEL | ICR_BSY | ICR_DATA)) != (ICR_SEL | ICR_DATA)) return;
+  for (int id = 0; id < SCSI_NUM_TARGETS; id++) {
+    if ((out_data & (1 << id)) && disks[id].blocks) {
+      target = id;
+      selecting = 1;
+      return;
+    }
+  }
+}
+
+static uint8_t bus_status() {
+  uint8_t bus = icr & ICR_SEL ? BUS_SEL : 0;
+  if (icr & ICR_BSY || mode & MODE_ARB || target >= 0) bus |= BUS_BSY;
+  if (target >= 0 && !selecting) {
+    bus |= phase << 2;
+    if (req) bus |= BUS_REQ;
+  }
+  return bus;
+}
+
+static uint8_t bus_and_status() {
+  uint8_t bas = 0;
+  if (icr & ICR_ACK) bas |= BAS_ACK;
+  if (icr & ICR_ATN) bas |= BAS_ATN;
+  int active = target >= 0 && !selecting;
+  if (!active || (tcr & 7) == phase) bas |= BAS_PHASE_MATCH;
+  if (mode & MODE_DMA) {
+    if (dma_ready() && req) bas |= BAS_DRQ;
+    else bas |= BAS_END_DMA;
+  }
+  return bas;
+}
+
+unsigned int scsi_read(unsigned int address) {
+  if (address & 0x200) { // pseudo-DMA
+    uint8_t value = bus_byte();
+    if (dma_ready() && (phase & PH_IO)) transfer(0);
+    return value;
+  }
+  switch ((address >> 4) & 7) {
+    case REG_DATA:
+    case REG_INPUT:
+      return bus_byte();
+    case REG_ICR:
+      return (icr & ~ICR_AIP) | (mode & MODE_ARB ? ICR_AIP : 0);
+    case REG_MODE:
+      return mode;
+    case REG_TCR:
+      return tcr;
+    case REG_BUS:
+      return bus_status();
+    case REG_BAS:
+      return bus_and_status();
+    default:
+      return 0;
+  }
+}
+
+void scsi_write(unsigned int address, unsigned int value) {
+  if (address & 0x200) { // pseudo-DMA
+    if (dma_ready() && !(phase & PH_IO)) transfer(value);
+    return;
+  }
+  switch ((address >> 4) & 7) {
+    case REG_DATA:
+      out_data = value;
+      break;
+    case REG_ICR:
+      if (value & ICR_RST) {
+        target = -1;
+        selecting = 0;
+        mode = 0;
+      }
+      // the target takes a byte on the rising edge of ACK and asks for the next one when it drops
+      if ((value & ICR_ACK) && !(icr & ICR_ACK) && target >= 0 && req) {
+        icr = value;
+        transfer(out_data);
+        req = 0;
+      } else if (!(value & ICR_ACK) && (icr & ICR_ACK)) {
+        req = target >= 0;
+      }
+      icr = value;
+      break;
+    case REG_MODE:
+      mode = value;
+      break;
+    case REG_TCR:
+      tcr = value;
+      break;
+    default:
+      break; // select enable and the DMA start registers, DACK accesses do the work
+  }
+  check_selection();
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "umac.h"
+
+// Mac Plus NCR 5380 SCSI controller with hard disks behind it, found at
+// 0x580000-0x5fffff (register in address bits 4-6, pseudo-DMA on bit 9)
+#define SCSI_BASE 0x580000
+#define SCSI_END 0x600000
+
+#ifndef SCSI_NUM_TARGETS
+#define SCSI_NUM_TARGETS 2
+#endif
+// Sectors moved by each call to the disc ops
+#ifndef SCSI_BUF_SECTORS
+#define SCSI_BUF_SECTORS 8
+#endif
+
+static inline int scsi_is_io(unsigned int address) {
+  return (address & 0xf80000) == SCSI_BASE;
+}
+
+// Serve disc (512-byte blocks) as the disk with SCSI ID id
+void scsi_attach(int id, disc_descr_t *disc);
+// Guest byte accesses to the controller
+unsigned int scsi_read(unsigned int address);
+void scsi_write(unsigned int address, unsigned int value);
@@ -0,0 +1,130 @@
+/* Save states:
+ *
+ * The snapshot is taken by core 1 between two umac_loop() calls, so the
+ * 68000 is between instructions. Disc writes still in the sector cache are
+ * handed to the staging buffer first; core 0 keeps draining it while the
+ * suspended machine waits to be switched off. The RAM is written and read
+ * in one f_write()/f_read() so that FatFs goes straight to multi-block
+ * transfers. umac's own VIA/SCC state is not reachable, the chips of the
+ * resumed machine are set up again from what the guest wrote to them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hardware/sync.h"
+#include "hardware/watchdog.h"
+#include "tf_card.h"
+#include "fatfs/ff.h"
+#include "m68k.h"
+
+#include "state.h"
+#include "mem_hooks.h"
+#include "disc_async.h"
+#include "disc_cache.h"
+#include "video.h"
+#include "log.h"
+#include "umac-build-id.h" // STATE_BUILD_ID, hash of the image sources and configuration
+
+#define STATE_FILE "umac.sav"
+#define STATE_MAGIC "UMSV"
+
+typedef struct {
+  char magic[4];
+  uint32_t build_id;      // snapshots only make sense for the very same firmware
+  uint32_t ram_size;
+  uint32_t context_size;
+  mem_io_shadow_t io;
+  // followed by the 68000 context and the RAM
+} state_header_t;
+
+static uint8_t *state_ram;
+static uint32_t state_ram_size;
+static volatile int save_requested = 0;
+
+void state_init(uint8_t *ram, uint32_t ram_size) {
+  state_ram = ram;
+  state_ram_size = ram_size;
+}
+
+static int state_save() {
+  static FIL fp;
+  state_header_t header = {.build_id = STATE_BUILD_ID, .ram_size = state_ram_size,
+                           .context_size = m68k_context_size(), .io = mem_io_shadow};
+  memcpy(header.magic, STATE_MAGIC, 4);
+  void *context = malloc(header.context_size);
+  if (!context) return -1;
+  m68k_get_context(context);
+
+  disc_cache_flush();
+  disc_async_lock();
+  UINT written[3] = {0};
+  FRESULT fr = f_open(&fp, STATE_FILE, FA_CREATE_ALWAYS | FA_WRITE);
+  if (fr == FR_OK) {
+    fr = f_write(&fp, &header, sizeof(header), &written[0]);
+    if (fr == FR_OK) fr = f_write(&fp, context, header.context_size, &written[1]);
+    if (fr == FR_OK) fr = f_write(&fp, state_ram, state_ram_size, &written[2]);
+    FRESULT closed = f_close(&fp);
+    if (fr == FR_OK) fr = closed;
+  }
+  int failed = fr != FR_OK || written[0] + written[1] + written[2] != sizeof(header) + header.context_size + state_ram_size;
+  if (failed) f_unlink(STATE_FILE); // never resume from a partial snapshot
+  disc_async_unlock();
+  free(context);
+
+  if (failed) {
+    LOG_ERROR("state: saving failed (%d)\n", fr);
+    return -1;
+  }
+  return 0;
+}
+
+int state_resume() {
+  static FIL fp;
+  state_header_t header;
+  UINT did_read = 0;
+  if (f_open(&fp, STATE_FILE, FA_OPEN_EXISTING | FA_READ) != FR_OK) return -1;
+
+  int result = -1;
+  int ram_touched = 0;
+  void *context = NULL;
+  if (f_read(&fp, &header, sizeof(header), &did_read) != FR_OK || did_read != sizeof(header) ||
+      memcmp(header.magic, STATE_MAGIC, 4) || header.build_id != STATE_BUILD_ID ||
+      header.ram_size != state_ram_size || header.context_size != m68k_context_size()) {
+    printf("state: %s is not for this firmware, ignored\n", STATE_FILE);
+  } else if ((context = malloc(header.context_size)) != NULL &&
+             f_read(&fp, context, header.context_size, &did_read) == FR_OK && did_read == header.context_size) {
+    ram_touched = 1;
+    if (f_read(&fp, state_ram, state_ram_size, &did_read) == FR_OK && did_read == state_ram_size) {
+      mem_hooks_replay(&header.io);
+      m68k_set_context(context);
+      result = 0;
+    }
+  }
+  free(context);
+  f_close(&fp);
+  f_unlink(STATE_FILE);
+
+  if (result != 0 && ram_touched) {
+    // the RAM may be half loaded, start again with a clean boot (the snapshot is gone)
+    printf("state: reading %s failed\n", STATE_FILE);
+    watchdog_reboot(0, 0, 0);
+    while (1);
+  }
+  return result;
+}
+
+void state_request_save() {
+  save_requested = 1;
+}
+
+void state_poll() {
+  if (!save_requested) return;
+  save_requested = 0;
+  if (state_save() != 0) return; // carry on, nothing is lost
+  printf("state: saved to %s\n", STATE_FILE);
+  fb_printf(0, 0, 1, "Saved, the Pico can be switched off");
+  video_invalidate();
+  while (1) __wfe();
+}
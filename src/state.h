@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+
+// Whole machine snapshots in umac.sav on the SD card: Mac RAM, 68000 context
+// and the VIA/SCC configuration. A snapshot is resumed once, then deleted, as
+// the discs go on changing afterwards.
+
+void state_init(uint8_t *ram, uint32_t ram_size);
+// Core 1, after umac_init(): returns 0 when a snapshot was loaded
+int state_resume();
+// Core 0: have core 1 save and suspend the machine at the next safe point
+void state_request_save();
+// Core 1, between umac_loop() calls
+void state_poll();
@@ -31,19 +31,62 @@
 #include <stdint.h>
 #include <stdarg.h>
 
+#include "hardware/sync.h"
+
 #include "video.h"
+#include "video_conv.h"
 
 #include "lcd_3bit.h"
+#include "lcd.h"
 #include "font.h"
 
 static uint8_t *video_framebuffer = NULL;
 
+volatile uint8_t video_dirty_lines[DISP_HEIGHT];
+
+void video_invalidate() {
+  memset((uint8_t*) video_dirty_lines, 1, DISP_HEIGHT);
+}
+
 void    video_init(uint32_t *framebuffer) {
   video_framebuffer = (uint8_t*) framebuffer;
+  video_conv_init();
   memset(video_framebuffer, DISP_WIDTH * DISP_HEIGHT / 8, 0);
+  video_invalidate();
 }
 
+// A row buffer may only be reused once the transfer started from it is done,
+// lcd_stream() waits for the previous one so two are enough
+#define VIDEO_ROW_BUFFERS 2
+
 int video_offset_x = 0, video_offset_y = 0;
+static int drawn_offset_x = -1, drawn_offset_y = -1;
+
+// When the whole Mac screen fits in the LCD's 480 lines of GRAM, it is kept there
+// row for row and vertical panning only moves the scroll start address. The top
+// VIDEO_PINNED_LINES (the menu bar) can be held in place with the fixed area.
+#if DISP_HEIGHT > HEIGHT && DISP_HEIGHT <= MEM_HEIGHT
+#define VIDEO_HW_SCROLL 1
+#ifndef VIDEO_PINNED_LINES
+#define VIDEO_PINNED_LINES 0
+#endif
+#else
+#undef VIDEO_PINNED_LINES
+#define VIDEO_PINNED_LINES 0
+#endif
+
+// framebuffer line shown on screen row y, and the GRAM row it is stored at
+static inline int video_line(int y) {
+  return y < VIDEO_PINNED_LINES ? y : y + video_offset_y;
+}
+
+static inline int video_gram_row(int y) {
+#ifdef VIDEO_HW_SCROLL
+  return video_line(y);
+#else
+  return y;
+#endif
+}
 
 // https://github.com/evansm7/umac/pull/16/commits/d90f36714560389c47107c3fc3b3463a5ca09c14
 // read mouse position directly from emulator memory:
@@ -91,9 +134,118 @@ extern int mouse_mode, cursor_x, cursor_y;
 
 void hid_app_task(void);
 
+// Overview: the whole framebuffer shrunk by 5/8 in gray levels, centered on the
+// panel switched to RGB565 and streamed by DMA like the 1:1 view
+#define OVERVIEW_WIDTH (DISP_WIDTH / 8 * 5 < WIDTH ? DISP_WIDTH / 8 * 5 : WIDTH)
+#define OVERVIEW_HEIGHT ((DISP_HEIGHT * 5 + 7) / 8 < HEIGHT ? (DISP_HEIGHT * 5 + 7) / 8 : HEIGHT)
+#define OVERVIEW_LEFT ((WIDTH - OVERVIEW_WIDTH) / 2)
+#define OVERVIEW_TOP ((HEIGHT - OVERVIEW_HEIGHT) / 2)
+
+static volatile int overview_requested = 0;
+static int overview_shown = 0;
+
+void video_toggle_overview() {
+  overview_requested = !overview_requested;
+}
+
+// Core 0 can hand the panel over to a full screen menu, in the 3-bit format
+// and with GRAM rows shown as they are
+static int video_suspended = 0;
+
+void video_suspend() {
+  lcd_wait();
+  video_suspended = 1;
+  if (overview_shown) {
+    lcd565_end();
+    overview_shown = 0;
+    overview_requested = 0;
+  }
+#ifdef VIDEO_HW_SCROLL
+  if (drawn_offset_y >= 0) lcd_scroll(VIDEO_PINNED_LINES);
+#endif
+}
+
+void video_resume() {
+  video_suspended = 0;
+  drawn_offset_x = drawn_offset_y = -1; // redraw everything and restore the scroll position
+}
+
+// every 5 output rows cover 8 lines: first line of each row and the share of
+// the (up to) 3 lines it covers, in fifths
+static const uint8_t shrink_first[5] = {0, 1, 3, 4, 6};
+static const uint8_t shrink_weights[5][3] = {{5, 3, 0}, {2, 5, 1}, {4, 4, 0}, {1, 5, 2}, {3, 5, 0}};
+
+// source lines and weights of output row r, tells whether one of them changed
+static int video_overview_lines(int r, const uint8_t *lines[3], uint8_t weights[3], const uint8_t *changed) {
+  int first = r / 5 * 8 + shrink_first[r % 5];
+  int dirty = 0;
+  for (int k = 0; k < 3; k++) {
+    int line = first + k < DISP_HEIGHT ? first + k : DISP_HEIGHT - 1;
+    weights[k] = first + k < DISP_HEIGHT ? shrink_weights[r % 5][k] : 0; // below the screen is white
+    lines[k] = video_framebuffer + line * DISP_WIDTH/8;
+    if (weights[k]) dirty |= changed[line];
+  }
+  return dirty;
+}
+
+static void video_update_overview() {
+  static uint16_t rows[VIDEO_ROW_BUFFERS][OVERVIEW_WIDTH] __attribute__((aligned(4)));
+  static int current_row = 0;
+  uint8_t changed[DISP_HEIGHT];
+  uint8_t dirty[OVERVIEW_HEIGHT];
+  const uint8_t *lines[3];
+  uint8_t weights[3];
+
+  // lines feed up to two output rows, so take all flags first; a line is only
+  // cleared when seen set, a write landing in between keeps its flag
+  for (int line = 0; line < DISP_HEIGHT; line++) {
+    changed[line] = video_dirty_lines[line];
+    if (changed[line]) video_dirty_lines[line] = 0;
+  }
+  __dmb();
+  for (int r = 0; r < OVERVIEW_HEIGHT; r++) dirty[r] = video_overview_lines(r, lines, weights, changed);
+
+  // each run of changed output rows goes out through a single LCD window
+  int run = 0;
+  for (int r = 0; r < OVERVIEW_HEIGHT; r++) {
+    if (r % 80 == 0) hid_app_task();
+    if (run == 0) {
+      if (!dirty[r]) continue;
+      while (r + run < OVERVIEW_HEIGHT && dirty[r + run]) run++;
+      lcd_begin_window(OVERVIEW_LEFT, OVERVIEW_TOP + r, OVERVIEW_WIDTH, run);
+    }
+    video_overview_lines(r, lines, weights, changed);
+    uint16_t *row = rows[current_row];
+    video_shrink_row(row, lines, weights, OVERVIEW_WIDTH / 5);
+    lcd_stream((uint8_t *) row, OVERVIEW_WIDTH * 2);
+    current_row = (current_row + 1) % VIDEO_ROW_BUFFERS;
+    if (--run == 0) lcd_end_window();
+  }
+}
+
 void video_update() {
 
-  if (video_framebuffer == NULL) return;
+  if (video_framebuffer == NULL || video_suspended) return;
+
+  // switch pixel format in place, GRAM is simply redrawn in the new one
+  if (overview_requested != overview_shown) {
+    overview_shown = overview_requested;
+    if (overview_shown) {
+#ifdef VIDEO_HW_SCROLL
+      if (drawn_offset_y >= 0) lcd_scroll(VIDEO_PINNED_LINES); // GRAM rows shown as they are
+#endif
+      lcd_fill(0, 0, 0, WIDTH, HEIGHT); // the border, while the 3-bit fill still applies
+      lcd565_begin();
+      video_invalidate();
+    } else {
+      lcd565_end();
+      drawn_offset_x = drawn_offset_y = -1; // redraw everything and restore the scroll position
+    }
+  }
+  if (overview_shown) {
+    video_update_overview();
+    return;
+  }
 
   int mouse_x = RAM_RD16(0x82a); // directly read mouse coordinates from emulator
   int mouse_y = RAM_RD16(0x828);
@@ -102,26 +254,50 @@ void video_update() {
   if (mouse_x >= 0 && mouse_x < DISP_WIDTH && mouse_y >= 0 && mouse_y < DISP_HEIGHT) {
     while (mouse_x < video_offset_x && video_offset_x > 0) video_offset_x--;
     while (mouse_x > video_offset_x + 320 && video_offset_x < DISP_WIDTH - 320) video_offset_x++;
-    while (mouse_y < video_offset_y && video_offset_y > 0) video_offset_y--;
+    while (mouse_y >= VIDEO_PINNED_LINES && mouse_y < video_offset_y + VIDEO_PINNED_LINES && video_offset_y > 0) video_offset_y--;
     while (mouse_y > video_offset_y + 320 && video_offset_y < DISP_HEIGHT - 320) video_offset_y++;
   }
 
-  // draw row by row
-  uint8_t row[160];
+  // panning invalidates everything on screen, except vertically when GRAM holds the whole screen
+  if (video_offset_x != drawn_offset_x) {
+    video_invalidate();
+    drawn_offset_x = video_offset_x;
+  }
+  if (video_offset_y != drawn_offset_y) {
+#ifdef VIDEO_HW_SCROLL
+    if (drawn_offset_y < 0) lcd_setup_scrolling(VIDEO_PINNED_LINES, 0);
+    lcd_scroll(VIDEO_PINNED_LINES + video_offset_y);
+#else
+    video_invalidate();
+#endif
+    drawn_offset_y = video_offset_y;
+  }
+
+  // draw changed rows only, converting a row while the previous one is sent by DMA;
+  // each run of consecutive dirty rows goes out through a single LCD window
+  static uint8_t rows[VIDEO_ROW_BUFFERS][160] __attribute__((aligned(4)));
+  static int current_row = 0;
+  uint32_t span[320/32];
+  int run = 0;
   for (int y = 0; y < 320; y++) {
-    uint8_t* fb_out = row;
-    for (int x = 0; x < 320; x += 16) {
-      uint8_t plo = video_framebuffer[(x + video_offset_x)/8 + ((y + video_offset_y) * DISP_WIDTH/8) + 0];
-      uint8_t phi = video_framebuffer[(x + video_offset_x)/8 + ((y + video_offset_y) * DISP_WIDTH/8) + 1];
-      for (int i = 0; i < 8; i+=2) {
-        *fb_out++ = ((plo & (0x80 >> i)) ? 0 : 56) | ((plo & (0x80 >> (i + 1))? 0 : 7));
-      }
-      for (int i = 0; i < 8; i+=2) {
-        *fb_out++ = ((phi & (0x80 >> i)) ? 0 : 56) | ((phi & (0x80 >> (i + 1))? 0 : 7));
-      }
-    }       
-    lcd_draw(row, 0, y, 320, 1);
     if (y % 80 == 0) hid_app_task(); // check for key presses more often
+    int line = video_line(y);
+    if (run == 0) {
+      if (!video_dirty_lines[line]) continue;
+      do run++;
+      while (y + run < 320 && video_dirty_lines[video_line(y + run)] && video_gram_row(y + run) == video_gram_row(y) + run);
+      lcd_begin_window(0, video_gram_row(y), 320, run);
+    }
+    // clear before reading the line so that a concurrent write from the emulator marks it again
+    video_dirty_lines[line] = 0;
+    __dmb();
+
+    uint8_t* row = rows[current_row];
+    video_fetch_span(span, video_framebuffer + line * DISP_WIDTH/8, video_offset_x, 320/32);
+    video_conv_row(row, (uint8_t*) span, 320/8);
+    lcd_stream(row, 160);
+    current_row = (current_row + 1) % VIDEO_ROW_BUFFERS;
+    if (--run == 0) lcd_end_window();
   }
 
   // mouse indicator
@@ -151,6 +327,7 @@ void fb_fill_rect(int x, int y, int width, int height, uint8_t color) {
       if (color) video_framebuffer[byte] |= bit;
       else video_framebuffer[byte] &= ~bit;
     }
+    video_mark_dirty(j);
   }
 }
 
@@ -169,6 +346,7 @@ void fb_draw_char(int x, int y, uint8_t color, char c) {
         }
       }
     }
+    if (y + j >= 0 && y + j < DISP_HEIGHT) video_mark_dirty(y + j);
     offset++;
   }
 }
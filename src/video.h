@@ -1,7 +1,25 @@
 #pragma once
 
+#include <stdint.h>
+
+// One flag per framebuffer scanline, set by the emulator when a line is written
+// and cleared by video_update() once the line has been sent to the LCD. Bytes
+// rather than bits so that both cores can update it with plain stores.
+extern volatile uint8_t video_dirty_lines[DISP_HEIGHT];
+
+static inline void video_mark_dirty(int line) {
+  video_dirty_lines[line] = 1;
+}
+
+void video_invalidate();
+
 void video_init(uint32_t *framebuffer);
 void video_update();
+// Switch between 1:1 panning and the shrunk view of the whole screen
+void video_toggle_overview();
+// Stop drawing while core 0 uses the LCD for something else, everything is redrawn on resume
+void video_suspend();
+void video_resume();
 void fb_fill_rect(int x, int y, int width, int height, uint8_t color);
 void fb_draw_char(int x, int y, uint8_t color, char c);
 void fb_draw_text(int x, int y, uint8_t color, const char* text);
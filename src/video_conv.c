@@ -0,0 +1,118 @@
+/* 1bpp to 3-bit pixel conversion
+ *
+ * Each framebuffer byte (8 pixels) expands to 4 LCD bytes, precomputed in a
+ * 256-entry table so the row loop has no per-pixel branches. Spans starting at
+ * any pixel are extracted beforehand with 32-bit loads and funnel shifts. The
+ * overview shrink works the same way, a byte giving the black coverage of its 5
+ * output pixels which are then weighted per line and mapped to a gray. Free
+ * of SDK dependencies so that it can be built on the host as well.
+ */
+
+#include <stdint.h>
+
+#ifdef PICO
+#include "pico.h"
+#else
+#define __not_in_flash_func(f) f
+#endif
+
+#include "video_conv.h"
+
+#define WHITE_HI 56 // first pixel of a pair, in bits 5..3
+#define WHITE_LO 7  // second pixel, in bits 2..0
+
+static uint32_t conv_table[256];
+
+// black coverage (0..8) of the 5 output pixels of a byte, 4 packed in bytes and
+// the last one apart, so that a line weight multiplies all of them at once
+static uint32_t shrink_table[256];
+static uint8_t shrink_last[256];
+// RGB565 gray for a black coverage of 0..64 (8 fifths by 8 fifths), bytes
+// swapped so that a 16-bit store puts the high byte first, as the panel takes it
+static uint16_t shrink_gray[65];
+
+// coverage of source pixel i by output pixel j, in fifths
+static int shrink_weight(int j, int i) {
+  int lo = 5 * i > 8 * j ? 5 * i : 8 * j;
+  int hi = 5 * (i + 1) < 8 * (j + 1) ? 5 * (i + 1) : 8 * (j + 1);
+  return hi > lo ? hi - lo : 0;
+}
+
+void video_conv_init() {
+  for (int b = 0; b < 256; b++) {
+    uint32_t word = 0;
+    for (int k = 0; k < 4; k++) {
+      uint8_t out = ((b & (0x80 >> (2 * k))) ? 0 : WHITE_HI) | ((b & (0x40 >> (2 * k))) ? 0 : WHITE_LO);
+      word |= (uint32_t) out << (8 * k); // little endian: byte k lands at out[k]
+    }
+    conv_table[b] = word;
+
+    uint8_t sums[5] = {0};
+    for (int j = 0; j < 5; j++)
+      for (int i = 0; i < 8; i++)
+        if (b & (0x80 >> i)) sums[j] += shrink_weight(j, i);
+    shrink_table[b] = sums[0] | sums[1] << 8 | sums[2] << 16 | (uint32_t) sums[3] << 24;
+    shrink_last[b] = sums[4];
+  }
+  for (int c = 0; c <= 64; c++) {
+    int level = 255 - c * 255 / 64;
+    uint16_t gray = (level >> 3) << 11 | (level >> 2) << 5 | (level >> 3);
+    shrink_gray[c] = __builtin_bswap16(gray);
+  }
+}
+
+void __not_in_flash_func(video_conv_row)(uint8_t *out, const uint8_t *in, int bytes) {
+  uint32_t *o = (uint32_t*) out;
+  while (bytes > 0 && ((uintptr_t) in & 3)) {
+    *o++ = conv_table[*in++];
+    bytes--;
+  }
+  while (bytes >= 4) {
+    uint32_t w = *(const uint32_t*) in;
+    o[0] = conv_table[w & 0xff];
+    o[1] = conv_table[(w >> 8) & 0xff];
+    o[2] = conv_table[(w >> 16) & 0xff];
+    o[3] = conv_table[w >> 24];
+    o += 4;
+    in += 4;
+    bytes -= 4;
+  }
+  while (bytes-- > 0) *o++ = conv_table[*in++];
+}
+
+// framebuffer bytes are in display order, so words are big endian
+static inline uint32_t load_be32(const uint32_t *p) {
+  return __builtin_bswap32(*p);
+}
+
+void __not_in_flash_func(video_fetch_span)(uint32_t *out, const uint8_t *line, int bit_offset, int words) {
+  const uint32_t *src = (const uint32_t*) line + (bit_offset >> 5);
+  int shift = bit_offset & 31;
+  if (shift == 0) {
+    for (int i = 0; i < words; i++) out[i] = src[i];
+    return;
+  }
+  // only reads words holding requested pixels, never past the end of the line
+  uint32_t hi = load_be32(src);
+  for (int i = 0; i < words; i++) {
+    uint32_t lo = load_be32(src + i + 1);
+    out[i] = __builtin_bswap32((hi << shift) | (lo >> (32 - shift)));
+    hi = lo;
+  }
+}
+
+void __not_in_flash_func(video_shrink_row)(uint16_t *out, const uint8_t *const lines[3], const uint8_t weights[3], int bytes) {
+  const uint8_t *l0 = lines[0], *l1 = lines[1], *l2 = lines[2];
+  uint32_t w0 = weights[0], w1 = weights[1], w2 = weights[2];
+  for (int i = 0; i < bytes; i++) {
+    // each field stays <= 64, no carry into its neighbour
+    uint32_t acc = w0 * shrink_table[l0[i]] + w1 * shrink_table[l1[i]] + w2 * shrink_table[l2[i]];
+    uint32_t last = w0 * shrink_last[l0[i]] + w1 * shrink_last[l1[i]] + w2 * shrink_last[l2[i]];
+    out[0] = shrink_gray[acc & 0xff];
+    out[1] = shrink_gray[(acc >> 8) & 0xff];
+    out[2] = shrink_gray[(acc >> 16) & 0xff];
+    out[3] = shrink_gray[acc >> 24];
+    out[4] = shrink_gray[last];
+    out += 5;
+  }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+
+// Mac 1bpp framebuffer (MSB is the leftmost pixel, set is black) to the LCD's
+// 3-bit format (two pixels per byte), one table lookup per input byte.
+void video_conv_init();
+// out must be 4-byte aligned and hold 4 * bytes bytes
+void video_conv_row(uint8_t *out, const uint8_t *in, int bytes);
+// Copy words * 32 pixels starting at pixel bit_offset of a 4-byte aligned line,
+// keeping the framebuffer layout so the result can be fed to video_conv_row()
+void video_fetch_span(uint32_t *out, const uint8_t *line, int bit_offset, int words);
+
+// Overview: every 8 framebuffer pixels (and lines) shrink to 5 on screen, each
+// output pixel being the area average of what it covers, in 65 gray levels.
+// lines are the 3 framebuffer lines overlapping an output row, weights their
+// coverage in fifths of a line (summing to 8, 0 for unused ones). Writes
+// bytes * 5 RGB565 pixels, high byte first in memory as the panel takes them.
+void video_shrink_row(uint16_t *out, const uint8_t *const lines[3], const uint8_t weights[3], int bytes);
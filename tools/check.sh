@@ -0,0 +1,218 @@
+#!/bin/bash
+
+# Host checks and benchmarks of the firmware sources: builds the harness of
+# the check from tools/ with the host's cc and runs it in the current
+# directory. Without a check, lists them with their arguments.
+
+source "$(dirname $0)"/host.sh
+
+usage() {
+  echo "usage: $0 <check> [arguments], one of:" >& 2
+  sed -n 's/^## /  /p' "$0" >& 2
+  exit 1
+}
+
+# <rom.bin> <mem-size> <disp-width> <disp-height> [disc-in] [seconds], for
+# the checks booting a disc in umac
+umac_args() {
+  if [ $# -lt 4 ]; then
+    echo "usage: $0 $(sed -n "s/^## \($CHECK \)/\1/p" "$0")" >& 2
+    echo "rom.bin is the patched ROM left in the build directory, for the same sizes" >& 2
+    return 1
+  fi
+  ROM_BIN="$1"
+  MEMSIZE=$2
+  DISP_WIDTH=$3
+  DISP_HEIGHT=$4
+  DISC_IN="${5:-$DISC}"
+  SECONDS_RUN=${6:-30}
+}
+
+## dirty-lines <rom.bin> <mem-size> <disp-width> <disp-height> [disc-in] [seconds]
+# boots the disc with the memory hooks of the firmware and reports the LCD
+# lines pushed per frame
+check_dirty_lines() {
+  umac_args "$@" || return 1
+  umac_cc umac-lines "${WRAP_MEM_HOOKS[@]}" "$TOOLS"/umac-lines.c "$SRC"/src/mem_hooks.c || return 1
+  ./umac-lines "$ROM_BIN" "$DISC_IN" $SECONDS_RUN
+}
+
+## video-conv [rows]
+# checks the row conversion of src/video_conv.c against the loop it replaced
+# and times both
+check_video_conv() {
+  host_cc video-conv-test "$TOOLS"/video-conv-test.c "$SRC"/src/video_conv.c || return 1
+  ./video-conv-test "$@"
+}
+
+## disc-cache [disc-in] [operations]
+# runs the SD sector cache of src/disc_cache.c over file-backed copies of the
+# disc, for a few sizes
+check_disc_cache() {
+  for KB in 0 8 32 64 128; do
+    host_cc disc-cache-test -DDISC_CACHE_KB=$KB "$TOOLS"/disc-cache-test.c "$SRC"/src/disc_cache.c || return 1
+    ./disc-cache-test "${1:-$DISC}" ${2:-200000} || return 1
+  done
+}
+
+## disc-pack [disc-in] [reads]
+# packs disc images as the no-SD build does (tools/gen-disc.sh) and reads
+# them back through src/disc_packed.c: the disc, then blank, random and
+# partly filled ones of sizes that do not end on a block
+check_disc_pack() {
+  local DISC_IN="${1:-$DISC}"
+  host_cc disc-pack "$TOOLS"/disc-pack.c "$SRC"/src/disc_lz.c || return 1
+  host_cc disc-packed-test "$TOOLS"/disc-packed-test.c "$SRC"/src/disc_packed.c "$SRC"/src/disc_lz.c || return 1
+  head -c 409600 /dev/zero > disc-pack-blank.img
+  head -c 204801 /dev/urandom > disc-pack-random.img
+  { head -c 300000 "$DISC_IN"; head -c 100000 /dev/urandom; head -c 50001 /dev/zero; } > disc-pack-mixed.img
+  for IMAGE in "$DISC_IN" disc-pack-blank.img disc-pack-random.img disc-pack-mixed.img; do
+    echo "$IMAGE:"
+    ./disc-pack "$IMAGE" disc-pack.bin || return 1
+    ./disc-packed-test "$IMAGE" disc-pack.bin ${2:-100000} || return 1
+  done
+}
+
+## disc-prefetch [operations]
+# runs the read-ahead of src/disc_prefetch.c with a thread for each core over
+# a disc in memory: plain and with ThreadSanitizer
+check_disc_prefetch() {
+  for SANITIZE in "" "-fsanitize=thread"; do
+    host_cc disc-prefetch-test -g $SANITIZE "$TOOLS"/disc-prefetch-test.c "$SRC"/src/disc_prefetch.c -lpthread ||
+      return 1
+    ./disc-prefetch-test ${1:-200000} || return 1
+  done
+}
+
+## scsi [blocks]
+# formats and reads back a volume on a file-backed disk through the emulated
+# SCSI controller of src/scsi.c
+check_scsi() {
+  host_cc scsi-test "$TOOLS"/scsi-test.c "$SRC"/src/scsi.c || return 1
+  ./scsi-test scsi-test.img "$@"
+}
+
+## disc-flash-log [boots] [writes]
+# runs the flash log of the no-SD build over a flash image kept in a file,
+# for a number of boots, every other one ending with a power cut while
+# sectors are being committed
+check_disc_flash_log() {
+  host_cc disc-flash-log-test -DFLASH_LOG_KB=512 "$TOOLS"/disc-flash-log-test.c "$SRC"/src/disc_flash_log.c ||
+    return 1
+  for BOOT in $(seq 0 $((${1:-12} - 1))); do
+    ./disc-flash-log-test disc-flash-log.state $BOOT ${2:-20000} || return 1
+  done
+}
+
+## placement [functions] [budget-kb]
+# runs tools/gen-placement.sh on a library of functions of known sizes and a
+# profile of them, with entries for functions that are not in the library,
+# then checks the options against a pick of its own, from the section sizes
+# and the profile, and that objcopy moves exactly those to .time_critical
+check_placement() {
+  local FUNCTIONS=${1:-40} BUDGET_KB=${2:-4}
+  RANDOM=1
+  rm -f placement-lib.c placement-profile.txt
+  for I in $(seq 0 $((FUNCTIONS - 1))); do
+    # local symbols (t) as well as global ones (T)
+    if [ $((I % 5)) = 4 ]; then echo "static __attribute__((used))" >> placement-lib.c; fi
+    echo "int hot_$I(volatile int *v) {" >> placement-lib.c
+    local STATEMENTS=$((RANDOM % 60))
+    for J in $(seq 0 $STATEMENTS); do echo "  *v = *v * $((J + 3)) + $I;" >> placement-lib.c; done
+    echo "  return *v; }" >> placement-lib.c
+    # entered counts all different, some functions never entered
+    if [ $((I % 7)) != 6 ]; then echo "hot_$I $((RANDOM * FUNCTIONS + I))" >> placement-profile.txt; fi
+  done
+  echo "not_in_library $((RANDOM * FUNCTIONS + FUNCTIONS))" >> placement-profile.txt
+  cc -O1 -ffunction-sections -c -o placement-lib.o placement-lib.c || return 1
+  rm -f libplacement.a && ar rcs libplacement.a placement-lib.o || return 1
+  echo $BUDGET_KB > placement-budget.txt
+  "$TOOLS"/gen-placement.sh placement-profile.txt nm libplacement.a placement-budget.txt placement-options.txt ||
+    return 1
+  objcopy @placement-options.txt libplacement.a libplacement-hot.a || return 1
+
+  # the most entered first, each one that still fits
+  objdump -h placement-lib.o | awk '$2 ~ /^\.text\./ {sub(/^\.text\./, "", $2); print $2, $3}' |
+    while read NAME SIZE; do echo $NAME $((16#$SIZE)); done | sort > placement-sizes.txt
+  sort placement-profile.txt | join - placement-sizes.txt | sort -k2,2nr |
+    awk -v budget=$((BUDGET_KB * 1024)) 'used + $3 <= budget { used += $3; print $1 }' | sort > placement-expected.txt
+  sed 's/.*=\.time_critical\.//' placement-options.txt | sort > placement-chosen.txt
+  objdump -h libplacement-hot.a | awk '$2 ~ /^\.time_critical\./ {sub(/^\.time_critical\./, "", $2); print $2}' |
+    sort > placement-moved.txt
+  if ! cmp -s placement-expected.txt placement-chosen.txt || ! cmp -s placement-expected.txt placement-moved.txt; then
+    echo "FAILED: placed $(wc -l < placement-chosen.txt) functions, moved $(wc -l < placement-moved.txt)," \
+      "expected $(wc -l < placement-expected.txt)"
+    diff placement-expected.txt placement-chosen.txt
+    return 1
+  fi
+  echo "ok: $(wc -l < placement-expected.txt) of $FUNCTIONS functions placed in $BUDGET_KB KB"
+}
+
+## bench-profile <rom.bin> <mem-size> <disp-width> <disp-height> [disc-in] [seconds]
+# compares umac with the memory hooks and UMAC_PROFILE against a build
+# without: prints the profile table, with the overhead it estimates, and the
+# slowdown measured
+check_bench_profile() {
+  umac_args "$@" || return 1
+  umac_cc umac-profile-bench.0 -DUMAC_PROFILE=0 "${WRAP_MEM_HOOKS[@]}" \
+    "$TOOLS"/umac-profile-bench.c "$SRC"/src/mem_hooks.c || return 1
+  umac_cc umac-profile-bench.1 -DUMAC_PROFILE=1 "${WRAP_MEM_HOOKS[@]}" \
+    "$TOOLS"/umac-profile-bench.c "$SRC"/src/mem_hooks.c "$SRC"/src/profile.c || return 1
+
+  # fastest of three runs each, the host is rarely idle
+  rm -f umac-profile-bench.plain umac-profile-bench.profiled
+  for RUN in 1 2 3; do
+    ./umac-profile-bench.0 "$ROM_BIN" "$DISC_IN" $SECONDS_RUN >> umac-profile-bench.plain || return 1
+    ./umac-profile-bench.1 "$ROM_BIN" "$DISC_IN" $SECONDS_RUN > umac-profile-bench.profiled.$RUN || return 1
+    grep '^seconds' umac-profile-bench.profiled.$RUN >> umac-profile-bench.profiled
+  done
+  grep -v '^seconds' umac-profile-bench.profiled.3
+  awk '
+    /^seconds/ && (!(FILENAME in time) || $2 < time[FILENAME]) { time[FILENAME] = $2 }
+    END {
+      plain = time["umac-profile-bench.plain"]
+      profiled = time["umac-profile-bench.profiled"]
+      printf "without UMAC_PROFILE: %.3f s\n", plain
+      printf "with UMAC_PROFILE:    %.3f s\n", profiled
+      printf "measured overhead:    %.1f%% of the profiled run\n", (1 - plain / profiled) * 100
+    }' umac-profile-bench.plain umac-profile-bench.profiled
+}
+
+## bench-predecode <rom.bin> <mem-size> <disp-width> <disp-height> [disc-in] [seconds]
+# compares 68000 instructions per second with and without PREDECODE
+check_bench_predecode() {
+  umac_args "$@" || return 1
+  umac_cc umac-bench -DPREDECODE=1 \
+    -Wl,--wrap=m68k_execute -Wl,--wrap=cpu_write_byte -Wl,--wrap=cpu_write_word -Wl,--wrap=cpu_write_long \
+    "$TOOLS"/umac-bench.c "$SRC"/src/predecode.c || return 1
+  ./umac-bench "$ROM_BIN" "$DISC_IN" $SECONDS_RUN 1 > umac-bench.cached || return 1
+  ./umac-bench "$ROM_BIN" "$DISC_IN" $SECONDS_RUN 0 > umac-bench.plain || return 1
+  cat umac-bench.cached umac-bench.plain | awk '
+    /^instructions/ { instructions = $2 }
+    /^hits/ { print }
+    /^seconds/ { time[n++] = $2 }
+    END {
+      printf "predecode: %.2f M instructions/s\n", instructions / time[0] / 1e6
+      printf "musashi:   %.2f M instructions/s\n", instructions / time[1] / 1e6
+      printf "speedup:   %.2fx\n", time[1] / time[0]
+    }'
+}
+
+## mem-hooks [accesses]
+# checks the page table of the memory hooks against a reference decoder of
+# the Mac Plus map, for memory sizes that end on a 64K page and sizes that do
+# not
+check_mem_hooks() {
+  for MEMSIZE in 128 208 512 1024 4096; do
+    host_cc mem-hooks-test -DUMAC_MEMSIZE=$MEMSIZE -DDISP_WIDTH=512 -DDISP_HEIGHT=342 \
+      "$TOOLS"/mem-hooks-test.c "$SRC"/src/mem_hooks.c || return 1
+    ./mem-hooks-test "$@" || return 1
+  done
+}
+
+CHECK="$1"
+if [ -z "$CHECK" ] || ! declare -F "check_${CHECK//-/_}" > /dev/null; then
+  usage
+fi
+shift
+"check_${CHECK//-/_}" "$@"
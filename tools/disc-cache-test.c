@@ -0,0 +1,171 @@
+/* Host test of src/disc_cache.c:
+ *
+ * Puts the cache in front of two drives backed by files, copies of a disc
+ * image, and drives it with a random mix of sector and unaligned reads and
+ * writes (and flushes), checking every read against a copy of the disc kept
+ * in memory. After a last flush, the files must hold exactly that copy. Ends
+ * with reading the disc through twice in order, as a boot does with its
+ * resources, and prints the cache counters. Last, one dirty sector is made
+ * to fail its write-back while writes go on around it: every other sector
+ * written must still reach the file, and that one once the disc is back.
+ *
+ * usage: disc-cache-test <disc.img> [operations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "disc_cache.h"
+
+#define SECTOR_SIZE 512
+#define MOST_SECTORS 16            // per access, as umac's driver asks
+
+static int file_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  FILE *f = ctx;
+  return fseek(f, offset, SEEK_SET) == 0 && fread(data, 1, len, f) == len ? 0 : -1;
+}
+
+static FILE *failing_file;         // writes over failing_sector in there fail
+static unsigned int failing_sector;
+
+static int file_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  FILE *f = ctx;
+  if (f == failing_file && offset / SECTOR_SIZE <= failing_sector && (offset + len - 1) / SECTOR_SIZE >= failing_sector)
+    return -1;
+  return fseek(f, offset, SEEK_SET) == 0 && fwrite(data, 1, len, f) == len ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <disc.img> [operations]\n", argv[0]);
+    return 1;
+  }
+  int operations = argc > 2 ? atoi(argv[2]) : 200000;
+  FILE *in = fopen(argv[1], "rb");
+  if (!in) {
+    perror(argv[1]);
+    return 1;
+  }
+  fseek(in, 0, SEEK_END);
+  unsigned int size = ftell(in) / SECTOR_SIZE * SECTOR_SIZE;
+  unsigned int sectors = size / SECTOR_SIZE;
+  fseek(in, 0, SEEK_SET);
+
+  uint8_t *expected[DISC_NUM_DRIVES];
+  FILE *files[DISC_NUM_DRIVES];
+  disc_descr_t discs[DISC_NUM_DRIVES];
+  for (int d = 0; d < DISC_NUM_DRIVES; d++) {
+    expected[d] = malloc(size);
+    files[d] = tmpfile();
+    if (!expected[d] || !files[d] || file_read(in, expected[d], 0, size) != 0 ||
+        file_write(files[d], expected[d], 0, size) != 0) {
+      fprintf(stderr, "%s: cannot make the drive %d copy\n", argv[1], d);
+      return 1;
+    }
+    discs[d] = (disc_descr_t) {.base = 0, .read_only = 0, .size = size, .op_ctx = files[d],
+                               .op_read = file_read, .op_write = file_write};
+    disc_cache_attach(&discs[d], d);
+  }
+  fclose(in);
+
+  static uint8_t buffer[MOST_SECTORS * SECTOR_SIZE];
+  int bad = 0;
+  srand(1);
+  for (int op = 0; op < operations && !bad; op++) {
+    int d = rand() % DISC_NUM_DRIVES;
+    unsigned int offset, len;
+    if (rand() % 50 == 0) {
+      len = 1 + rand() % (2 * SECTOR_SIZE);
+      offset = rand() % (size - len);
+    } else {
+      int n = 1 + rand() % MOST_SECTORS;
+      // most accesses near the start, where the system files are
+      offset = (rand() % 4 ? rand() % (sectors / 8) : rand() % (sectors - n)) * SECTOR_SIZE;
+      if (offset + n * SECTOR_SIZE > size) offset = size - n * SECTOR_SIZE;
+      len = n * SECTOR_SIZE;
+    }
+    if (rand() % 3 == 0) {
+      for (unsigned int i = 0; i < len; i++) buffer[i] = rand();
+      memcpy(expected[d] + offset, buffer, len);
+      if (discs[d].op_write(discs[d].op_ctx, buffer, offset, len) != 0) {
+        printf("write error: drive %d, offset %u, length %u\n", d, offset, len);
+        bad++;
+      }
+    } else if (discs[d].op_read(discs[d].op_ctx, buffer, offset, len) != 0) {
+      printf("read error: drive %d, offset %u, length %u\n", d, offset, len);
+      bad++;
+    } else if (memcmp(buffer, expected[d] + offset, len) != 0) {
+      printf("read mismatch: operation %d, drive %d, offset %u, length %u\n", op, d, offset, len);
+      bad++;
+    }
+    if (rand() % 5000 == 0 && disc_cache_flush() != 0) {
+      printf("flush error\n");
+      bad++;
+    }
+  }
+  if (disc_cache_flush() != 0) {
+    printf("flush error\n");
+    bad++;
+  }
+  for (int d = 0; d < DISC_NUM_DRIVES; d++) {
+    uint8_t *file = malloc(size);
+    if (!file || file_read(files[d], file, 0, size) != 0 || memcmp(file, expected[d], size) != 0) {
+      printf("drive %d: file differs from what was written\n", d);
+      bad++;
+    }
+    free(file);
+  }
+  printf("random: %d operations, cache %d KB, hits %u misses %u evictions %u writebacks %u\n", operations,
+         DISC_CACHE_KB, disc_cache_stats.hits, disc_cache_stats.misses, disc_cache_stats.evictions,
+         disc_cache_stats.writebacks);
+
+  memset(&disc_cache_stats, 0, sizeof(disc_cache_stats));
+  for (int pass = 0; pass < 2; pass++) {
+    for (unsigned int sector = 0; sector < sectors / 8; sector += MOST_SECTORS / 2) {
+      unsigned int n = sectors / 8 - sector < MOST_SECTORS / 2 ? sectors / 8 - sector : MOST_SECTORS / 2;
+      if (discs[0].op_read(discs[0].op_ctx, buffer, sector * SECTOR_SIZE, n * SECTOR_SIZE) != 0 ||
+          memcmp(buffer, expected[0] + sector * SECTOR_SIZE, n * SECTOR_SIZE) != 0) {
+        printf("sequential read mismatch at sector %u\n", sector);
+        bad++;
+      }
+    }
+  }
+  printf("sequential: first eighth of the disc read twice, hits %u misses %u\n",
+         disc_cache_stats.hits, disc_cache_stats.misses);
+
+  // a sector that cannot be written back, the writes that evict it go through
+  memset(&disc_cache_stats, 0, sizeof(disc_cache_stats));
+  failing_sector = 3;
+  for (unsigned int i = 0; i < SECTOR_SIZE; i++) buffer[i] = rand();
+  memcpy(expected[0] + failing_sector * SECTOR_SIZE, buffer, SECTOR_SIZE);
+  if (discs[0].op_write(discs[0].op_ctx, buffer, failing_sector * SECTOR_SIZE, SECTOR_SIZE) != 0) bad++;
+  failing_file = files[0];
+  for (int op = 0; op < 2000; op++) {
+    unsigned int n = 1 + rand() % MOST_SECTORS;
+    unsigned int sector = failing_sector + 1 + rand() % (sectors / 8);
+    for (unsigned int i = 0; i < n * SECTOR_SIZE; i++) buffer[i] = rand();
+    memcpy(expected[0] + sector * SECTOR_SIZE, buffer, n * SECTOR_SIZE);
+    if (discs[0].op_write(discs[0].op_ctx, buffer, sector * SECTOR_SIZE, n * SECTOR_SIZE) != 0) {
+      printf("write error around a failing sector: sector %u, %u sectors\n", sector, n);
+      bad++;
+      break;
+    }
+  }
+  failing_file = NULL;
+  if (disc_cache_flush() != 0) {
+    printf("flush error after the failing sector\n");
+    bad++;
+  }
+  uint8_t *file = malloc(size);
+  if (!file || file_read(files[0], file, 0, size) != 0 || memcmp(file, expected[0], size) != 0) {
+    printf("drive 0: file differs after a failed write-back\n");
+    bad++;
+  }
+  free(file);
+  printf("failing write-back: %u evictions, %u writebacks\n", disc_cache_stats.evictions,
+         disc_cache_stats.writebacks);
+  printf("%s\n", bad ? "FAILED" : "ok");
+  return bad != 0;
+}
@@ -0,0 +1,221 @@
+/* Host test of the flash log (src/disc_flash_log.c):
+ *
+ * Runs the log over a flash image in RAM, kept in a file from one run to the
+ * next, each run standing for one boot of the Pico. A boot first reads the
+ * whole disc back and checks it against what the previous one left. It then
+ * writes a hot set of sectors over and over, with writes over a wider range
+ * now and then, partial sectors included, and random reads checked against a
+ * copy of the disc; core 0's service runs on a simulated clock. The log fills
+ * up, so garbage collection and wear levelling run too.
+ *
+ * A boot ends either cleanly, every staged sector committed, or with a power
+ * cut: everything is committed, a few more sectors are written, and flash
+ * programming stops at a random page while they are. The next boot must then
+ * read each of those sectors either as before or as written, never mixed or
+ * as anything else. Prints the wear of the log after each boot.
+ *
+ * usage: disc-flash-log-test <state-file> <boot> [writes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "disc_flash_log.h"
+
+#define FLASH_SECTOR_SIZE 4096     // erase unit, as on the Pico's flash
+#define FLASH_PAGE_SIZE 256        // program unit
+#define SECTOR_SIZE 512
+#define DISC_SECTORS 1600
+#define DISC_SIZE (DISC_SECTORS * SECTOR_SIZE)
+#define HOT_SECTORS 200
+#define WIDE_SECTORS 600           // written now and then, what the log holds with room to spare
+#define CUT_SECTORS 24             // written after the last commit of a cut boot
+
+uint8_t flash_image[FLASH_LOG_KB * 1024];
+
+// what is kept in the state file, with the flash
+static struct {
+  int cut;                         // the last boot ended with a power cut
+  uint8_t disc[DISC_SIZE];         // what the disc must read as
+  uint8_t cut_data[DISC_SIZE];     // sectors written before the cut
+  uint8_t cut_sectors[DISC_SECTORS];
+} state;
+
+static uint8_t base[DISC_SIZE];
+static uint32_t now_us;
+static int cut_pages = -1;         // page programs left before the power cut, -1 for none
+static long erase_count;
+
+void log_push(const char *fmt, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+  printf(fmt, a, b, c, d);
+}
+
+uint32_t time_us_32() {
+  return now_us;
+}
+
+void flash_range_erase(uint32_t offset, size_t count) {
+  if (offset % FLASH_SECTOR_SIZE || count % FLASH_SECTOR_SIZE || offset + count > sizeof(flash_image)) {
+    printf("FAILED: erase of %zu bytes at %u\n", count, offset);
+    exit(1);
+  }
+  if (cut_pages == 0) return;
+  memset(flash_image + offset, 0xff, count);
+  erase_count++;
+}
+
+void flash_range_program(uint32_t offset, const uint8_t *data, size_t count) {
+  if (offset % FLASH_PAGE_SIZE || count % FLASH_PAGE_SIZE || offset + count > sizeof(flash_image)) {
+    printf("FAILED: program of %zu bytes at %u\n", count, offset);
+    exit(1);
+  }
+  for (size_t page = 0; page < count; page += FLASH_PAGE_SIZE) {
+    if (cut_pages == 0) return;
+    if (cut_pages > 0) cut_pages--;
+    for (size_t i = page; i < page + FLASH_PAGE_SIZE; i++) flash_image[offset + i] &= data[i]; // bits only clear
+  }
+}
+
+int flash_safe_execute(void (*func)(void *), void *param, uint32_t timeout_ms) {
+  (void) timeout_ms;
+  func(param);
+  return 0;
+}
+
+// the guest waits for a stage slot: core 0 runs meanwhile
+void flash_log_host_wait() {
+  now_us += 2000000;
+  disc_flash_log_service();
+}
+
+static int base_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  (void) ctx;
+  memcpy(data, base + offset, len);
+  return 0;
+}
+
+static void save(const char *name) {
+  FILE *f = fopen(name, "wb");
+  if (!f || fwrite(flash_image, 1, sizeof(flash_image), f) != sizeof(flash_image) ||
+      fwrite(&state, 1, sizeof(state), f) != sizeof(state) || fclose(f)) {
+    perror(name);
+    exit(1);
+  }
+}
+
+static int load(const char *name) {
+  FILE *f = fopen(name, "rb");
+  if (!f) return -1;
+  int r = fread(flash_image, 1, sizeof(flash_image), f) == sizeof(flash_image) &&
+          fread(&state, 1, sizeof(state), f) == sizeof(state) ? 0 : -1;
+  fclose(f);
+  return r;
+}
+
+// after a cut, take each sector written before it as it was or as written
+static int check_boot(disc_descr_t *d) {
+  static uint8_t data[DISC_SIZE];
+  if (d->op_read(d->op_ctx, data, 0, DISC_SIZE)) {
+    printf("FAILED: reading the disc back\n");
+    return 1;
+  }
+  int kept = 0, lost = 0;
+  for (int sector = 0; sector < DISC_SECTORS; sector++) {
+    const uint8_t *got = data + sector * SECTOR_SIZE;
+    if (!memcmp(got, state.disc + sector * SECTOR_SIZE, SECTOR_SIZE)) {
+      lost += state.cut && state.cut_sectors[sector];
+      continue;
+    }
+    if (state.cut && state.cut_sectors[sector] && !memcmp(got, state.cut_data + sector * SECTOR_SIZE, SECTOR_SIZE)) {
+      memcpy(state.disc + sector * SECTOR_SIZE, got, SECTOR_SIZE);
+      kept++;
+      continue;
+    }
+    printf("FAILED: sector %d does not read as %s\n", sector, state.cut_sectors[sector] ? "before or after the cut"
+                                                                                       : "written");
+    return 1;
+  }
+  if (state.cut) printf("power cut: %d sectors written before it kept, %d lost\n", kept, lost);
+  state.cut = 0;
+  memset(state.cut_sectors, 0, sizeof(state.cut_sectors));
+  return 0;
+}
+
+static int write_sectors(disc_descr_t *d, unsigned int offset, unsigned int len, uint8_t *data) {
+  for (unsigned int i = 0; i < len; i++) data[i] = rand();
+  if (d->op_write(d->op_ctx, data, offset, len)) {
+    printf("FAILED: write of %u bytes at %u\n", len, offset);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s <state-file> <boot> [writes]\n", argv[0]);
+    return 1;
+  }
+  int boot = atoi(argv[2]);
+  int writes = argc > 3 ? atoi(argv[3]) : 20000;
+
+  srand(1);
+  for (int i = 0; i < DISC_SIZE; i++) base[i] = rand();
+  if (boot == 0 || load(argv[1]) != 0) {
+    memset(flash_image, 0xff, sizeof(flash_image));
+    memset(&state, 0, sizeof(state));
+    memcpy(state.disc, base, DISC_SIZE);
+  }
+
+  disc_descr_t d = {.base = 0, .read_only = 1, .size = DISC_SIZE, .op_ctx = NULL, .op_read = base_read,
+                    .op_write = NULL};
+  if (disc_flash_log_attach(&d) != 0) {
+    printf("FAILED: attach\n");
+    return 1;
+  }
+  if (check_boot(&d)) return 1;
+
+  srand(100 + boot);
+  static uint8_t data[8 * SECTOR_SIZE];
+  for (int i = 0; i < writes;) {
+    if (rand() % 3 == 0) {
+      unsigned int len = 1 + rand() % sizeof(data);
+      unsigned int offset = rand() % (DISC_SIZE - len);
+      if (d.op_read(d.op_ctx, data, offset, len) || memcmp(data, state.disc + offset, len)) {
+        printf("FAILED: read of %u bytes at %u\n", len, offset);
+        return 1;
+      }
+    } else {
+      unsigned int sector = rand() % 8 == 0 ? rand() % WIDE_SECTORS : rand() % HOT_SECTORS;
+      unsigned int len = rand() % 5 == 0 ? 1 + rand() % 700 : SECTOR_SIZE * (1 + rand() % 4);
+      unsigned int offset = sector * SECTOR_SIZE + (len % SECTOR_SIZE ? rand() % 300 : 0);
+      if (write_sectors(&d, offset, len, data)) return 1;
+      memcpy(state.disc + offset, data, len);
+      i++;
+    }
+    now_us += rand() % 200000;
+    disc_flash_log_service();
+  }
+  disc_flash_log_sync();
+
+  if (boot % 2) {
+    // the last writes are cut short while they are committed
+    for (int i = 0; i < CUT_SECTORS; i++) {
+      unsigned int sector = rand() % WIDE_SECTORS;
+      if (state.cut_sectors[sector]) continue; // one copy each, the first could be committed alone
+      if (write_sectors(&d, sector * SECTOR_SIZE, SECTOR_SIZE, data)) return 1;
+      memcpy(state.cut_data + sector * SECTOR_SIZE, data, SECTOR_SIZE);
+      state.cut_sectors[sector] = 1;
+    }
+    cut_pages = rand() % (CUT_SECTORS * 2 + 4);
+    disc_flash_log_sync();
+    state.cut = 1;
+  }
+  save(argv[1]);
+
+  printf("boot %d ok: %s, %u segments committed, %u sectors moved, %ld erases, wear %u..%u\n", boot,
+         boot % 2 ? "power cut" : "clean", disc_flash_log_stats.commits, disc_flash_log_stats.moved, erase_count,
+         disc_flash_log_stats.min_erases, disc_flash_log_stats.max_erases);
+  return 0;
+}
@@ -0,0 +1,68 @@
+/* disc-pack: compress a disc image for the in-flash disc of the no-SD build
+ *
+ * usage: disc-pack <disc.img> <packed.bin>
+ *
+ * Every block is checked to unpack back to the original before being written.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "disc_lz.h"
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s <disc.img> <packed.bin>\n", argv[0]);
+    return 1;
+  }
+
+  FILE *f = fopen(argv[1], "rb");
+  if (!f) {
+    perror(argv[1]);
+    return 1;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint32_t blocks = (size + DISC_LZ_BLOCK - 1) / DISC_LZ_BLOCK;
+  uint8_t *image = calloc(blocks, DISC_LZ_BLOCK); // last block padded with zeros
+  if (!image || fread(image, 1, size, f) != (size_t) size) {
+    perror(argv[1]);
+    return 1;
+  }
+  fclose(f);
+
+  uint32_t *offsets = calloc(blocks + 1, sizeof(uint32_t));
+  uint8_t *packed = malloc((size_t) blocks * (DISC_LZ_BLOCK + DISC_LZ_BLOCK / 255 + 16));
+  uint8_t check[DISC_LZ_BLOCK];
+  uint32_t start = sizeof(disc_lz_header_t) + (blocks + 1) * sizeof(uint32_t);
+  uint32_t len = 0;
+  for (uint32_t b = 0; b < blocks; b++) {
+    const uint8_t *block = image + (size_t) b * DISC_LZ_BLOCK;
+    offsets[b] = start + len;
+    int n = disc_lz_encode(block, DISC_LZ_BLOCK, packed + len);
+    if (n >= DISC_LZ_BLOCK) {
+      // stored as is, recognised by its length
+      memcpy(packed + len, block, DISC_LZ_BLOCK);
+      n = DISC_LZ_BLOCK;
+    } else if (disc_lz_decode(packed + len, n, check, DISC_LZ_BLOCK) != 0 || memcmp(check, block, DISC_LZ_BLOCK)) {
+      fprintf(stderr, "%s: block %u does not unpack correctly\n", argv[0], b);
+      return 1;
+    }
+    len += n;
+  }
+  offsets[blocks] = start + len;
+
+  disc_lz_header_t header = {.block_size = DISC_LZ_BLOCK, .size = size, .blocks = blocks};
+  memcpy(header.magic, DISC_LZ_MAGIC, 4);
+  FILE *out = fopen(argv[2], "wb");
+  if (!out || fwrite(&header, sizeof(header), 1, out) != 1 ||
+      fwrite(offsets, sizeof(uint32_t), blocks + 1, out) != blocks + 1 ||
+      fwrite(packed, 1, len, out) != len || fclose(out) != 0) {
+    perror(argv[2]);
+    return 1;
+  }
+  printf("%s: %ld bytes packed to %u (%d%%)\n", argv[1], size, start + len, (int) ((start + len) * 100LL / size));
+  return 0;
+}
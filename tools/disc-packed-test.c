@@ -0,0 +1,92 @@
+/* Host test of the packed in-flash disc (tools/disc-pack.c, src/disc_packed.c):
+ *
+ * Serves an image packed by disc-pack through disc_packed_attach() and checks
+ * it against the original: the size, every sector read in order, then random
+ * reads of 1 byte to 16 sectors at any offset, crossing blocks and ending on
+ * the last byte, all bit for bit. Reads past the end and an image without the
+ * packed header must be refused. Prints how much the image was packed.
+ *
+ * usage: disc-packed-test <disc.img> <packed.bin> [reads]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "disc_packed.h"
+#include "disc_lz.h"
+
+#define SECTOR_SIZE 512
+#define MOST_SECTORS 16            // per access, as umac's driver asks
+
+void log_push(const char *fmt, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+  printf(fmt, a, b, c, d);
+}
+
+static uint8_t *load(const char *name, long *size) {
+  FILE *f = fopen(name, "rb");
+  if (!f) {
+    perror(name);
+    exit(1);
+  }
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t *data = malloc(*size + 1);
+  if (!data || fread(data, 1, *size, f) != (size_t) *size) {
+    fprintf(stderr, "%s: read error\n", name);
+    exit(1);
+  }
+  fclose(f);
+  return data;
+}
+
+static int fail(const char *what, unsigned int offset, unsigned int len) {
+  printf("FAILED: %s at %u, %u bytes\n", what, offset, len);
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s <disc.img> <packed.bin> [reads]\n", argv[0]);
+    return 1;
+  }
+  long size, packed_size;
+  uint8_t *image = load(argv[1], &size);
+  uint8_t *packed = load(argv[2], &packed_size);
+  int reads = argc > 3 ? atoi(argv[3]) : 100000;
+  static uint8_t data[MOST_SECTORS * SECTOR_SIZE];
+
+  disc_descr_t disc = {0};
+  if (disc_packed_attach(&disc, packed) != 0) return fail("packed image refused", 0, packed_size);
+  if (disc.size != (unsigned int) size || !disc.read_only || disc.op_write) return fail("wrong descriptor", 0, disc.size);
+
+  // in order, as a boot reads
+  for (unsigned int offset = 0; offset < size; offset += SECTOR_SIZE) {
+    unsigned int len = size - offset < SECTOR_SIZE ? size - offset : SECTOR_SIZE;
+    if (disc.op_read(disc.op_ctx, data, offset, len) || memcmp(data, image + offset, len))
+      return fail("sector read", offset, len);
+  }
+
+  srand(1);
+  for (int i = 0; i < reads; i++) {
+    unsigned int len = rand() & 1 ? (1 + rand() % MOST_SECTORS) * SECTOR_SIZE : 1 + rand() % sizeof(data);
+    if (len > size) len = size;
+    unsigned int offset = i % 16 == 0 ? size - len : (unsigned int) rand() % (size - len + 1);
+    if (disc.op_read(disc.op_ctx, data, offset, len) || memcmp(data, image + offset, len))
+      return fail("random read", offset, len);
+  }
+
+  if (disc.op_read(disc.op_ctx, data, size - SECTOR_SIZE + 1, SECTOR_SIZE) == 0)
+    return fail("read across the end accepted", size - SECTOR_SIZE + 1, SECTOR_SIZE);
+  if (disc.op_read(disc.op_ctx, data, size, 1) == 0) return fail("read past the end accepted", size, 1);
+  disc_descr_t raw = {0};
+  if (disc_packed_attach(&raw, image) == 0 && memcmp(image, DISC_LZ_MAGIC, 4))
+    return fail("image without a packed header accepted", 0, size);
+
+  const disc_lz_header_t *header = (const disc_lz_header_t *) packed;
+  printf("ok: %ld bytes in %u blocks packed to %ld (%ld%%), %d random reads\n", size, header->blocks, packed_size,
+         packed_size * 100 / size, reads);
+  return 0;
+}
@@ -0,0 +1,139 @@
+/* Host test of src/disc_prefetch.c:
+ *
+ * Runs the prefetcher with a thread standing for each core: core 1 reads and
+ * writes a disc held in memory through the prefetch ops, with runs of
+ * sequential sector reads (as a boot or a file copy does) broken by random
+ * reads, unaligned reads and writes, while core 0 calls
+ * disc_prefetch_service() in a loop. The backend is slowed down so that
+ * fills overlap the guest's accesses. Every read is checked against a copy of
+ * the disc kept by core 1; writes landing on a buffer being filled or ready
+ * must never let stale sectors through. Prints the prefetch counters.
+ *
+ * usage: disc-prefetch-test [operations]
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "disc_prefetch.h"
+
+#define SECTOR_SIZE 512
+#define SECTORS 2048
+#define MOST_SECTORS 16            // per access, as umac's driver asks
+
+static uint8_t disc[SECTORS * SECTOR_SIZE];
+static uint8_t copy[SECTORS * SECTOR_SIZE];
+static pthread_mutex_t card_lock = PTHREAD_MUTEX_INITIALIZER; // the SD card takes one command at a time
+static atomic_int done = 0;
+
+void log_push(const char *fmt, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+  (void) fmt;
+  (void) a;
+  (void) b;
+  (void) c;
+  (void) d;
+}
+
+static void card_delay(unsigned int len) {
+  for (unsigned int i = 0; i < len / SECTOR_SIZE; i++) sched_yield();
+}
+
+static int card_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  (void) ctx;
+  if (offset + len > sizeof(disc)) {
+    printf("FAILED: backend read past the end at %u, %u bytes\n", offset, len);
+    exit(1);
+  }
+  pthread_mutex_lock(&card_lock);
+  memcpy(data, disc + offset, len);
+  pthread_mutex_unlock(&card_lock);
+  card_delay(len);
+  return 0;
+}
+
+static int card_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  (void) ctx;
+  pthread_mutex_lock(&card_lock);
+  memcpy(disc + offset, data, len);
+  pthread_mutex_unlock(&card_lock);
+  card_delay(len);
+  return 0;
+}
+
+static void *core0(void *arg) {
+  (void) arg;
+  while (!done) {
+    disc_prefetch_service();
+    sched_yield();
+  }
+  return NULL;
+}
+
+static int check(disc_descr_t *d, unsigned int offset, unsigned int len, const char *what) {
+  static uint8_t data[MOST_SECTORS * SECTOR_SIZE];
+  if (d->op_read(d->op_ctx, data, offset, len) || memcmp(data, copy + offset, len)) {
+    printf("FAILED: %s at %u, %u bytes\n", what, offset, len);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int operations = argc > 1 ? atoi(argv[1]) : 200000;
+  srand(1);
+  for (unsigned int i = 0; i < sizeof(disc); i++) disc[i] = rand();
+  memcpy(copy, disc, sizeof(disc));
+
+  disc_descr_t d = {.base = 0, .read_only = 0, .size = sizeof(disc), .op_ctx = NULL,
+                    .op_read = card_read, .op_write = card_write};
+  disc_prefetch_attach(&d, 0);
+  pthread_t thread;
+  pthread_create(&thread, NULL, core0, NULL);
+
+  uint32_t next = 0;
+  static uint8_t data[MOST_SECTORS * SECTOR_SIZE];
+  for (int i = 0; i < operations; i++) {
+    int op = rand() % 16;
+    if (op < 10) {
+      // sequential run, wrapping at the end of the disc
+      uint32_t n = 1 + rand() % 4;
+      if (next + n > SECTORS) next = 0;
+      if (check(&d, next * SECTOR_SIZE, n * SECTOR_SIZE, "sequential read")) return 1;
+      next += n;
+    } else if (op < 12) {
+      uint32_t n = 1 + rand() % MOST_SECTORS;
+      uint32_t first = rand() % (SECTORS - n + 1);
+      if (check(&d, first * SECTOR_SIZE, n * SECTOR_SIZE, "random read")) return 1;
+      if (rand() % 4 == 0) next = first + n;
+    } else if (op < 13) {
+      unsigned int len = 1 + rand() % 1000;
+      unsigned int offset = rand() % (sizeof(disc) - len);
+      if (check(&d, offset, len, "unaligned read")) return 1;
+    } else {
+      // writes, often just ahead of the run where the prefetch buffer is
+      uint32_t n = 1 + rand() % 4;
+      uint32_t first = op < 15 ? (next + rand() % 8) % (SECTORS - n) : rand() % (SECTORS - n);
+      for (uint32_t j = 0; j < n * SECTOR_SIZE; j++) data[j] = rand();
+      memcpy(copy + first * SECTOR_SIZE, data, n * SECTOR_SIZE);
+      if (d.op_write(d.op_ctx, data, first * SECTOR_SIZE, n * SECTOR_SIZE)) {
+        printf("FAILED: write at sector %u\n", first);
+        return 1;
+      }
+    }
+  }
+  done = 1;
+  pthread_join(thread, NULL);
+
+  if (memcmp(disc, copy, sizeof(disc))) {
+    printf("FAILED: the disc does not hold what was written\n");
+    return 1;
+  }
+  printf("ok: %d operations, hits %u fetched %u wasted %u\n", operations, disc_prefetch_stats.hits,
+         disc_prefetch_stats.fetched, disc_prefetch_stats.wasted);
+  return 0;
+}
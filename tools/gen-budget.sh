@@ -0,0 +1,30 @@
+#!/bin/bash
+
+# Works out the SRAM left for hot umac code from a link of the firmware with
+# umac in flash: the heap between __end__ and __StackLimit, less what is
+# claimed from it at run time
+
+if [ $# != 4 ]; then
+  echo "usage: $0 <nm> <firmware.elf> <heap-reserve-kb> <budget-out>" >& 2
+  exit 1
+fi
+
+NM="$1"
+ELF="$2"
+RESERVE_KB="$3"
+BUDGET_OUT="$4"
+
+END=$("$NM" "$ELF" | awk '$3 == "__end__" {print $1}')
+STACK_LIMIT=$("$NM" "$ELF" | awk '$3 == "__StackLimit" {print $1}')
+if [ -z "$END" ] || [ -z "$STACK_LIMIT" ]; then
+  echo "$0: no __end__ or __StackLimit in $ELF" >& 2
+  exit 1
+fi
+
+HEAP_KB=$(( (16#$STACK_LIMIT - 16#$END) / 1024 ))
+BUDGET_KB=$(( HEAP_KB - RESERVE_KB ))
+if [ $BUDGET_KB -lt 0 ]; then
+  BUDGET_KB=0
+fi
+echo "SRAM budget: ${HEAP_KB}K heap after the firmware, ${RESERVE_KB}K reserved, ${BUDGET_KB}K for hot code" >& 2
+echo $BUDGET_KB > "$BUDGET_OUT"
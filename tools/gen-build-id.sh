@@ -0,0 +1,16 @@
+#!/bin/bash
+
+# Writes the build id of the firmware, checked when resuming a save state: a
+# hash of everything the image is built from, sources, headers, patched ROM
+# and build configuration, so that any change gives another id
+
+if [ $# -lt 2 ]; then
+  echo "usage: $0 <build-id-out.h> <file>..." >& 2
+  exit 1
+fi
+
+BUILD_ID_OUT_H="$1"
+shift
+
+BUILD_ID=$(cat "$@" | sha256sum | cut -c 1-8) || exit 1
+echo "#define STATE_BUILD_ID 0x${BUILD_ID}u" > "$BUILD_ID_OUT_H"
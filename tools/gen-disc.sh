@@ -0,0 +1,17 @@
+#!/bin/bash
+
+# Packs a disc image for flash (tools/disc-pack.c) into a C array
+
+source "$(dirname $0)"/host.sh
+
+if [ $# != 2 ]; then
+  echo "usage: $0 <disc-in> <disc-out.h>" >& 2
+  exit 1
+fi
+
+DISC_IN="$1"
+DISC_OUT_H="$2"
+
+host_cc disc-pack "$TOOLS"/disc-pack.c "$SRC"/src/disc_lz.c || exit 1
+./disc-pack "$DISC_IN" disc.bin || exit 1
+xxd -i < disc.bin > "$DISC_OUT_H"
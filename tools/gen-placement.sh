@@ -0,0 +1,26 @@
+#!/bin/bash
+
+# Turns a profile from tools/gen-profile.sh into objcopy options moving the most
+# entered functions of a library to .time_critical sections (copied to SRAM at
+# boot), as many as fit in the budget, sizes taken from the target objects
+
+if [ $# != 5 ]; then
+  echo "usage: $0 <profile> <nm> <library.a> <budget-file> <objcopy-options-out>" >& 2
+  exit 1
+fi
+
+PROFILE="$1"
+NM="$2"
+LIBRARY="$3"
+BUDGET_KB=$(cat "$4")
+OPTIONS_OUT="$5"
+
+"$NM" -S -t d --defined-only "$LIBRARY" | awk 'NF == 4 && ($3 == "t" || $3 == "T") {print $4, $2 + 0}' | sort > umac-sizes.txt
+sort "$PROFILE" | join - umac-sizes.txt | sort -k2,2nr |
+  awk -v budget=$((BUDGET_KB * 1024)) '
+    used + $3 <= budget {
+      used += $3
+      count++
+      printf "--rename-section .text.%s=.time_critical.%s\n", $1, $1
+    }
+    END { printf "SRAM placement: %d functions, %d of %d bytes\n", count, used, budget > "/dev/stderr" }' > "$OPTIONS_OUT"
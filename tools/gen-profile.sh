@@ -0,0 +1,28 @@
+#!/bin/bash
+
+# Profiles umac on the host, booting a disc: prints "<function> <times entered>"
+# for the emulator and Musashi functions, to pick the ones to run from SRAM
+
+source "$(dirname $0)"/host.sh
+
+if [ $# != 7 ]; then
+  echo "usage: $0 <rom.bin> <disc-in> <mem-size> <disp-width> <disp-height> <seconds> <profile-out>" >& 2
+  exit 1
+fi
+
+ROM_BIN="$1"
+DISC_IN="$2"
+MEMSIZE=$3
+DISP_WIDTH=$4
+DISP_HEIGHT=$5
+SECONDS_RUN=$6
+PROFILE_OUT="$7"
+
+echo "Profiling umac with MEMSIZE=$MEMSIZE on $DISC_IN for $SECONDS_RUN seconds"
+umac_cc umac-profile -no-pie -finstrument-functions "$TOOLS"/umac-profile.c || exit 1
+./umac-profile "$ROM_BIN" "$DISC_IN" $SECONDS_RUN > umac-profile.raw || exit 1
+sort -o umac-profile.raw umac-profile.raw
+
+# addresses to names
+nm -n --defined-only umac-profile | awk '$2 == "t" || $2 == "T" {print $1, $3}' | sort > umac-profile.syms
+join umac-profile.raw umac-profile.syms | awk '{print $3, $2}' | sort -k2,2nr > "$PROFILE_OUT"
@@ -0,0 +1,33 @@
+# Sourced by the host scripts of tools/: where the sources are, and how to
+# build host programs from them
+
+TOOLS="$(dirname "${BASH_SOURCE[0]}")"
+SRC="$TOOLS"/..
+EMU="$SRC"/external/umac_multidrive
+MUSASHI="$EMU"/external/Musashi
+DISC="$SRC"/discs/system3.3-finder5.5-en.img
+
+# umac's memory accessors, wrapped by the memory hooks
+WRAP_MEM_HOOKS=(-Wl,--wrap=cpu_read_byte -Wl,--wrap=cpu_read_word -Wl,--wrap=cpu_read_long
+  -Wl,--wrap=cpu_write_byte -Wl,--wrap=cpu_write_word -Wl,--wrap=cpu_write_long)
+
+# host_cc <program> <cc options and sources>...: a program over sources of
+# src/, which is only searched for quoted includes (src/sched.h would hide
+# the system's <sched.h>)
+host_cc() {
+  local PROGRAM="$1"
+  shift
+  cc -O2 -iquote "$SRC"/src -I"$EMU"/include -o "$PROGRAM" "$@"
+}
+
+# umac_cc <program> <cc options and sources>...: a program linked with umac
+# and Musashi, built for MEMSIZE, DISP_WIDTH and DISP_HEIGHT
+umac_cc() {
+  local PROGRAM="$1"
+  shift
+  make -C "$EMU" prepare || return 1
+  cc -O2 -DUMAC_MEMSIZE=$MEMSIZE -DDISP_WIDTH=$DISP_WIDTH -DDISP_HEIGHT=$DISP_HEIGHT \
+    -DMUSASHI_CNF=\"../include/m68kconf.h\" -I"$EMU"/include -I"$MUSASHI" -o "$PROGRAM" "$@" \
+    "$EMU"/src/disc.c "$EMU"/src/main.c "$EMU"/src/rom.c "$EMU"/src/scc.c "$EMU"/src/via.c \
+    "$MUSASHI"/m68kcpu.c "$MUSASHI"/m68kdasm.c "$MUSASHI"/m68kops.c "$MUSASHI"/softfloat/softfloat.c -lm
+}
@@ -0,0 +1,264 @@
+/* Host test of the page table of src/mem_hooks.c:
+ *
+ * Runs the wrapped accessors against two machines. The first stands for
+ * umac: its __real_cpu_*() decode every address the way umac does, over the
+ * RAM and ROM the page table points at. The second is a reference decoder
+ * with its own copy of the RAM, given every access directly. Random reads
+ * and writes of every size, aligned or not, across page ends, in RAM, its
+ * mirrors, the ROM, I/O and the unmapped space, must read the same on both,
+ * and the RAM must match at the end, with the overlay switched on and off by
+ * VIA writes as the boot code does. Also checks that no access to a page of
+ * plain memory reaches umac, that writes to the framebuffer mark the right
+ * lines, and that the VIA state replayed on resume writes port A back as
+ * last written, through register 1 or 15. mem-hooks in tools/check.sh runs
+ * it for memory sizes that end on a page and sizes that do not.
+ *
+ * usage: mem-hooks-test [accesses]  (built for one MEMSIZE, DISP_WIDTH and DISP_HEIGHT)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "umac.h"
+#include "mem_hooks.h"
+
+#define ROM_SIZE 0x20000
+#define ROM_BASE 0x400000
+#define OVERLAY_RAM 0x600000     // where the RAM is while the ROM is at 0
+#define VIA_BASE 0xe80000
+#define VIA_END 0xf00000
+#define VIA_REG0 0xefe1fe
+#define VIA_OVERLAY 0x10
+#define OPEN_BUS 0xa5            // what unmapped and I/O reads return on both machines
+#define FB_OFFSET 0x8000
+
+volatile uint8_t video_dirty_lines[DISP_HEIGHT];
+
+typedef struct {
+  uint8_t *ram;
+  int overlay;
+  int port_a;                    // last VIA port A output, either register
+} machine_t;
+
+// a page past the end, so that a partial last page mapped whole reads what umac would not
+static uint8_t ram[RAM_SIZE + 0x10000], ref_ram[RAM_SIZE], rom[ROM_SIZE];
+static machine_t umac = {ram, 1}, ref = {ref_ram, 1};
+static long slow_accesses;
+
+// the Mac Plus map as umac decodes it: RAM mirrored up to the ROM, at 0x600000
+// under the overlay, the ROM mirrored over 0x400000-0x4fffff and at 0 under the overlay
+static uint8_t *decode(machine_t *m, unsigned int address, int write) {
+  address &= 0xffffff;
+  if (address < ROM_BASE) {
+    if (m->overlay) return address < 0x100000 && !write ? &rom[address % ROM_SIZE] : NULL;
+    return &m->ram[address % RAM_SIZE];
+  }
+  if (address < 0x500000) return write ? NULL : &rom[address % ROM_SIZE];
+  if (m->overlay && address >= OVERLAY_RAM && address < OVERLAY_RAM + 0x200000) return &m->ram[address % RAM_SIZE];
+  return NULL;
+}
+
+static unsigned int bus_read(machine_t *m, unsigned int address) {
+  uint8_t *p = decode(m, address, 0);
+  return p ? *p : OPEN_BUS;
+}
+
+static void bus_write(machine_t *m, unsigned int address, unsigned int value) {
+  address &= 0xffffff;
+  uint8_t *p = decode(m, address, 1);
+  if (p) *p = value;
+  int reg = (address >> 9) & 0xf;
+  if (address >= VIA_BASE && address < VIA_END && (reg == 1 || reg == 15)) {
+    m->overlay = !!(value & VIA_OVERLAY);
+    m->port_a = value & 0xff;
+  }
+}
+
+static unsigned int ref_read(unsigned int address, int size) {
+  unsigned int value = 0;
+  for (int i = 0; i < size; i++) value = value << 8 | bus_read(&ref, address + i);
+  return value;
+}
+
+static void ref_write(unsigned int address, int size, unsigned int value) {
+  for (int i = 0; i < size; i++) bus_write(&ref, address + i, value >> (8 * (size - 1 - i)));
+}
+
+// umac's own accessors, which the hooks fall back on
+unsigned int __real_cpu_read_byte(unsigned int address) {
+  slow_accesses++;
+  return bus_read(&umac, address);
+}
+
+unsigned int __real_cpu_read_word(unsigned int address) {
+  slow_accesses++;
+  return bus_read(&umac, address) << 8 | bus_read(&umac, address + 1);
+}
+
+unsigned int __real_cpu_read_long(unsigned int address) {
+  slow_accesses++;
+  unsigned int value = 0;
+  for (int i = 0; i < 4; i++) value = value << 8 | bus_read(&umac, address + i);
+  return value;
+}
+
+void __real_cpu_write_byte(unsigned int address, unsigned int value) {
+  slow_accesses++;
+  bus_write(&umac, address, value);
+}
+
+void __real_cpu_write_word(unsigned int address, unsigned int value) {
+  slow_accesses++;
+  bus_write(&umac, address, value >> 8);
+  bus_write(&umac, address + 1, value);
+}
+
+void __real_cpu_write_long(unsigned int address, unsigned int value) {
+  slow_accesses++;
+  for (int i = 0; i < 4; i++) bus_write(&umac, address + i, value >> (8 * (3 - i)));
+}
+
+unsigned int __wrap_cpu_read_byte(unsigned int address);
+unsigned int __wrap_cpu_read_word(unsigned int address);
+unsigned int __wrap_cpu_read_long(unsigned int address);
+void __wrap_cpu_write_byte(unsigned int address, unsigned int value);
+void __wrap_cpu_write_word(unsigned int address, unsigned int value);
+void __wrap_cpu_write_long(unsigned int address, unsigned int value);
+
+static unsigned int hooks_read(unsigned int address, int size) {
+  return size == 1 ? __wrap_cpu_read_byte(address) : size == 2 ? __wrap_cpu_read_word(address)
+                                                                 : __wrap_cpu_read_long(address);
+}
+
+static void hooks_write(unsigned int address, int size, unsigned int value) {
+  if (size == 1) __wrap_cpu_write_byte(address, value);
+  else if (size == 2) __wrap_cpu_write_word(address, value);
+  else __wrap_cpu_write_long(address, value);
+}
+
+static void set_overlay(int on) {
+  unsigned int reg = rand() % 2 ? 15 : 1;
+  hooks_write(VIA_REG0 | reg << 9, 1, on ? VIA_OVERLAY : 0);
+  ref_write(VIA_REG0 | reg << 9, 1, on ? VIA_OVERLAY : 0);
+}
+
+// a page the table must map: plain memory over the whole 64K on both machines
+static int direct_page(unsigned int address, int write) {
+  unsigned int page = address & 0xff0000;
+  if (umac.overlay || page + 0x10000 > RAM_SIZE) return !write && page >= ROM_BASE && page < ROM_BASE + ROM_SIZE;
+  return 1;
+}
+
+static unsigned int pick_address() {
+  static const unsigned int bases[] = {0, OVERLAY_RAM, ROM_BASE, 0x100000, RAM_SIZE & ~0xffff, ROM_BASE + ROM_SIZE,
+                                       0x500000, VIA_BASE, 0xfffff0};
+  switch (rand() % 4) {
+  case 0: // the end of a page
+    return (rand() & 0xff0000) + 0x10000 - 1 - rand() % 4;
+  case 1:
+    return (bases[rand() % (sizeof(bases) / sizeof(bases[0]))] + rand() % 0x30000) & 0xffffff;
+  case 2:
+    return rand() % RAM_SIZE;
+  default:
+    return rand() & 0xffffff;
+  }
+}
+
+static int check_lines() {
+  unsigned int stride = DISP_WIDTH / 8;
+  for (int i = 0; i < 1000; i++) {
+    unsigned int line = rand() % DISP_HEIGHT;
+    int size = 1 << rand() % 3;
+    unsigned int address = FB_OFFSET + line * stride + rand() % stride;
+    memset((void *) video_dirty_lines, 0, sizeof(video_dirty_lines));
+    unsigned int value = rand() & (size == 4 ? 0xffffffff : (1u << 8 * size) - 1);
+    hooks_write(address, size, value);
+    ref_write(address, size, value);
+    unsigned int last = (address + size - 1 - FB_OFFSET) / stride;
+    for (unsigned int l = 0; l < DISP_HEIGHT; l++) {
+      if (video_dirty_lines[l] != (l == line || (l == last && last < DISP_HEIGHT))) {
+        printf("FAILED: %d-byte write at %06x, line %u %s\n", size, address, l,
+               video_dirty_lines[l] ? "marked" : "not marked");
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+static int check_replay() {
+  for (int i = 0; i < 1000; i++) {
+    unsigned int value = 0;
+    for (int n = 1 + rand() % 3; n > 0; n--) {
+      value = rand() & 0xff;
+      hooks_write(VIA_REG0 | (rand() % 2 ? 15 : 1) << 9, 1, value);
+    }
+    mem_io_shadow_t shadow = mem_io_shadow;
+    umac.port_a = -1;
+    mem_hooks_replay(&shadow);
+    if (umac.port_a != (int) value) {
+      printf("FAILED: port A replayed as %02x, last written %02x\n", umac.port_a, value);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  long accesses = argc > 1 ? atol(argv[1]) : 4000000;
+
+  srand(1);
+  for (int i = 0; i < ROM_SIZE; i++) rom[i] = rand();
+  for (int i = 0; i < RAM_SIZE; i++) ram[i] = ref_ram[i] = rand();
+  memset(ram + RAM_SIZE, OPEN_BUS ^ 0xff, 0x10000);
+  mem_hooks_init(FB_OFFSET, ram, rom);
+
+  long direct = 0, fallback = 0;
+  for (long i = 0; i < accesses; i++) {
+    if (rand() % 100000 == 0) set_overlay(!umac.overlay);
+    if (i == accesses / 4) set_overlay(0); // as the boot code does, most accesses are made without it
+    unsigned int address = pick_address();
+    int size = 1 << rand() % 3;
+    int write = rand() % 2;
+    if (address >= VIA_BASE && address < VIA_END && write) continue; // overlay switches only through set_overlay()
+    // odd words and longs, and longs across two pages, are left to umac
+    int expect_direct = !(address & 1 && size > 1) && (address & 0xffff) + size <= 0x10000 &&
+                        direct_page(address, write);
+    long slow = slow_accesses;
+    if (write) {
+      unsigned int value = rand() & (size == 4 ? 0xffffffff : (1u << 8 * size) - 1);
+      hooks_write(address, size, value);
+      ref_write(address, size, value);
+    } else {
+      unsigned int got = hooks_read(address, size), want = ref_read(address, size);
+      if (got != want) {
+        printf("FAILED: %d-byte read at %06x, overlay %s: %0*x, not %0*x\n", size, address,
+               umac.overlay ? "on" : "off", 2 * size, got, 2 * size, want);
+        return 1;
+      }
+    }
+    if (umac.overlay != ref.overlay) {
+      printf("FAILED: overlay %s after a %d-byte access at %06x\n", umac.overlay ? "on" : "off", size, address);
+      return 1;
+    }
+    if (expect_direct && slow_accesses != slow) {
+      printf("FAILED: %d-byte %s at %06x, overlay %s, went through umac\n", size, write ? "write" : "read", address,
+             umac.overlay ? "on" : "off");
+      return 1;
+    }
+    if (slow_accesses != slow) fallback++;
+    else direct++;
+  }
+  if (memcmp(ram, ref_ram, RAM_SIZE)) {
+    printf("FAILED: RAM differs from the reference\n");
+    return 1;
+  }
+  set_overlay(0);
+  if (check_lines() || check_replay()) return 1;
+
+  printf("%ld accesses over %d KB of RAM: %ld through the page table, %ld through umac\n", accesses,
+         RAM_SIZE / 1024, direct, fallback);
+  return 0;
+}
@@ -0,0 +1,224 @@
+/* Host test of src/scsi.c:
+ *
+ * Plays the Mac's SCSI Manager against the emulated 5380: arbitration and
+ * selection by hand, command bytes handshaked through the initiator command
+ * register, data moved by pseudo-DMA, then status and message in. The disk
+ * behind it is a file. The test formats it (FORMAT UNIT, then every block
+ * written with WRITE(10) in 128-block chunks), reads the volume back with
+ * READ(6) and READ(10) at random places, checks the file itself holds what
+ * was written, and that commands reaching past the last block fail with an
+ * ILLEGAL REQUEST sense while the last block reads.
+ *
+ * usage: scsi-test <image> [blocks]  (the image is created or truncated)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "scsi.h"
+
+#define SECTOR_SIZE 512
+#define CHUNK 128
+
+// 5380 registers, in address bits 4-6; the Mac reads odd and writes even
+#define REG(r) (SCSI_BASE | (r) << 4)
+#define RD(r) scsi_read(REG(r))
+#define WR(r, v) scsi_write(REG(r) | 1, v)
+#define DACK_READ (SCSI_BASE | 0x260)
+#define DACK_WRITE (SCSI_BASE | 0x201)
+
+#define PHASE_DATA_OUT 0
+#define PHASE_DATA_IN 1
+#define PHASE_COMMAND 2
+#define PHASE_STATUS 3
+#define PHASE_MSG_IN 7
+
+#define NO_TARGET -1
+
+static FILE *image;
+
+void log_push(const char* fmt, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+  printf(fmt, a, b, c, d);
+}
+
+static int file_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  (void) ctx;
+  return fseek(image, offset, SEEK_SET) == 0 && fread(data, 1, len, image) == len ? 0 : -1;
+}
+
+static int file_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  (void) ctx;
+  return fseek(image, offset, SEEK_SET) == 0 && fwrite(data, 1, len, image) == len ? 0 : -1;
+}
+
+static void fail(const char *what) {
+  printf("FAILED: %s\n", what);
+  exit(1);
+}
+
+// phase of the REQ the target raises
+static int wait_req() {
+  for (int i = 0; i < 100; i++) {
+    int bus = RD(4);
+    if (bus & 0x20) return (bus >> 2) & 7;
+  }
+  fail("no REQ from the target");
+  return -1;
+}
+
+static void handshake_out(uint8_t value) {
+  WR(0, value);
+  WR(1, 0x01);
+  WR(1, 0x11);
+  if (RD(4) & 0x20) fail("REQ still up after ACK");
+  WR(1, 0x01);
+}
+
+static uint8_t handshake_in() {
+  uint8_t value = RD(0);
+  WR(1, 0x10);
+  if (RD(4) & 0x20) fail("REQ still up after ACK");
+  WR(1, 0);
+  return value;
+}
+
+// one command to target id, len bytes of data in or out by pseudo-DMA;
+// returns the status byte, or NO_TARGET when nothing answers the selection
+static int command(int id, const uint8_t *cdb, int cdb_len, uint8_t *data, int len) {
+  WR(0, 0x80);                  // our ID, 7
+  WR(2, 1);                     // arbitrate
+  if (!(RD(1) & 0x40)) fail("arbitration not in progress");
+  WR(1, 0x0d);                  // SEL, BSY, data bus
+  WR(0, 0x80 | 1 << id);
+  WR(2, 0);
+  WR(1, 0x05);                  // let go of BSY, the target answers with it
+  if (!(RD(4) & 0x40)) return NO_TARGET;
+  WR(1, 0);
+  if (wait_req() != PHASE_COMMAND) fail("no command phase");
+  WR(3, PHASE_COMMAND);
+  for (int i = 0; i < cdb_len; i++) handshake_out(cdb[i]);
+
+  int phase = wait_req();
+  if (len && (phase == PHASE_DATA_IN || phase == PHASE_DATA_OUT)) {
+    WR(3, phase);
+    WR(2, 2);                   // DMA mode
+    WR(phase == PHASE_DATA_IN ? 7 : 5, 0);
+    for (int i = 0; i < len; i++) {
+      if (!(RD(5) & 0x40)) fail("no DRQ during the data phase");
+      if (phase == PHASE_DATA_IN) data[i] = scsi_read(DACK_READ);
+      else scsi_write(DACK_WRITE, data[i]);
+    }
+    if (RD(5) & 0x40) fail("DRQ after the last byte");
+    WR(2, 0);
+    phase = wait_req();
+  }
+  if (phase != PHASE_STATUS) fail("no status phase");
+  WR(3, PHASE_STATUS);
+  uint8_t status = handshake_in();
+  if (wait_req() != PHASE_MSG_IN) fail("no message in phase");
+  WR(3, PHASE_MSG_IN);
+  if (handshake_in() != 0) fail("message is not command complete");
+  if (RD(4) & 0x40) fail("bus still busy after the command");
+  return status;
+}
+
+static uint8_t pattern(uint32_t offset) {
+  return (offset * 2654435761u) >> 24;
+}
+
+static int rw10(uint8_t opcode, uint32_t lba, uint32_t count, uint8_t *data) {
+  uint8_t cdb[10] = {opcode, 0, lba >> 24, lba >> 16, lba >> 8, lba, 0, count >> 8, count, 0};
+  return command(0, cdb, 10, data, count * SECTOR_SIZE);
+}
+
+static void expect_range_error(uint32_t lba, uint32_t count, const char *what) {
+  static uint8_t sense[18];
+  if (rw10(0x28, lba, count, NULL) != 2) fail(what);
+  uint8_t request_sense[6] = {0x03, 0, 0, 0, 18, 0};
+  if (command(0, request_sense, 6, sense, 18) != 0 || sense[2] != 0x5 || sense[12] != 0x21)
+    fail("no ILLEGAL REQUEST, LBA out of range sense");
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <image> [blocks]\n", argv[0]);
+    return 1;
+  }
+  uint32_t blocks = argc > 2 ? atoi(argv[2]) : 40960;
+  image = fopen(argv[1], "w+b");
+  if (!image || ftruncate(fileno(image), (off_t) blocks * SECTOR_SIZE) != 0) {
+    perror(argv[1]);
+    return 1;
+  }
+  disc_descr_t disc = {.base = 0, .read_only = 0, .size = blocks * SECTOR_SIZE, .op_ctx = NULL,
+                       .op_read = file_read, .op_write = file_write};
+  scsi_attach(0, &disc);
+  static uint8_t data[CHUNK * SECTOR_SIZE];
+
+  uint8_t test_unit_ready[6] = {0};
+  if (command(0, test_unit_ready, 6, NULL, 0) != 0) fail("test unit ready");
+  if (command(3, test_unit_ready, 6, NULL, 0) != NO_TARGET) fail("ID 3 answered without a disk");
+  uint8_t inquiry[6] = {0x12, 0, 0, 0, 36, 0};
+  if (command(0, inquiry, 6, data, 36) != 0) fail("inquiry");
+  printf("inquiry: %.28s\n", data + 8);
+  uint8_t read_capacity[10] = {0x25};
+  if (command(0, read_capacity, 10, data, 8) != 0) fail("read capacity");
+  uint32_t last = data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+  if (last != blocks - 1) fail("read capacity gives the wrong last block");
+
+  // format: FORMAT UNIT, then the whole volume written
+  uint8_t format_unit[6] = {0x04};
+  if (command(0, format_unit, 6, NULL, 0) != 0) fail("format unit");
+  for (uint32_t lba = 0; lba < blocks; lba += CHUNK) {
+    uint32_t n = blocks - lba < CHUNK ? blocks - lba : CHUNK;
+    for (uint32_t i = 0; i < n * SECTOR_SIZE; i++) data[i] = pattern(lba * SECTOR_SIZE + i);
+    if (rw10(0x2a, lba, n, data) != 0) fail("write (10)");
+  }
+
+  // the file holds the volume
+  fflush(image);
+  FILE *check = fopen(argv[1], "rb");
+  for (uint32_t offset = 0; check && offset < blocks * SECTOR_SIZE; offset++) {
+    int c = fgetc(check);
+    if (c != pattern(offset)) {
+      printf("image byte %u is %d\n", offset, c);
+      fail("image file differs from what was written");
+    }
+  }
+  if (!check) fail("cannot reopen the image");
+  fclose(check);
+
+  // read back at random, both command sizes
+  srand(3);
+  for (int i = 0; i < 2000; i++) {
+    uint32_t n = 1 + rand() % (CHUNK - 1);
+    uint32_t lba = rand() % (blocks - n + 1);
+    int status;
+    if (rand() & 1 && lba < 0x200000) {
+      uint8_t read6[6] = {0x08, lba >> 16, lba >> 8, lba, n, 0};
+      status = command(0, read6, 6, data, n * SECTOR_SIZE);
+    } else {
+      status = rw10(0x28, lba, n, data);
+    }
+    if (status != 0) fail("read");
+    for (uint32_t k = 0; k < n * SECTOR_SIZE; k++)
+      if (data[k] != pattern(lba * SECTOR_SIZE + k)) {
+        printf("block %u, byte %u\n", lba, k);
+        fail("read back differs from what was written");
+      }
+  }
+
+  // the last block reads, nothing past it does, not even an empty transfer
+  if (rw10(0x28, blocks - 1, 1, data) != 0) fail("read of the last block");
+  expect_range_error(blocks - 1, 2, "read across the end accepted");
+  expect_range_error(blocks, 1, "read past the end accepted");
+  expect_range_error(blocks, 0, "empty read at the end accepted");
+  expect_range_error(0xffff00, 1, "read far past the end accepted");
+
+  fclose(image);
+  printf("ok: %u blocks formatted, written and read back\n", blocks);
+  return 0;
+}
@@ -0,0 +1,127 @@
+/* Host benchmark of src/predecode.c:
+ *
+ * Boots the patched ROM on a disc image for a number of emulated seconds,
+ * with umac's m68k_execute() wrapped (-Wl,--wrap, as on the Pico) to run
+ * either Musashi's own loop or predecode_execute(), and prints the host time
+ * taken. The emulated run is the same both ways, so the instruction count
+ * printed with the cache also holds without it (see bench-predecode in
+ * tools/check.sh).
+ *
+ * usage: umac-bench <rom.bin> <disc.img> <seconds> <0: Musashi, 1: predecode>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "umac.h"
+#include "../src/predecode.h"
+
+#define LOOPS_PER_VSYNC 26         // umac_loop() runs about 5000 cycles, a 60.15Hz frame is 130240
+#define VIA_OVERLAY 0x10
+
+int __real_m68k_execute(int num_cycles);
+void __real_cpu_write_byte(unsigned int address, unsigned int value);
+void __real_cpu_write_word(unsigned int address, unsigned int value);
+void __real_cpu_write_long(unsigned int address, unsigned int value);
+
+static int cached;
+static unsigned int overlay = VIA_OVERLAY;
+
+int __wrap_m68k_execute(int num_cycles) {
+  return cached ? predecode_execute(num_cycles) : __real_m68k_execute(num_cycles);
+}
+
+// as in src/mem_hooks.c
+void __wrap_cpu_write_byte(unsigned int address, unsigned int value) {
+  __real_cpu_write_byte(address, value);
+  if (!cached) return;
+  int reg = (address >> 9) & 0xf;
+  if (address >= 0xe80000 && address < 0xf00000 && (reg == 1 || reg == 15) && (value & VIA_OVERLAY) != overlay) {
+    overlay = value & VIA_OVERLAY;
+    predecode_flush();
+  }
+  predecode_write(address, 1);
+}
+
+void __wrap_cpu_write_word(unsigned int address, unsigned int value) {
+  __real_cpu_write_word(address, value);
+  if (cached) predecode_write(address, 2);
+}
+
+void __wrap_cpu_write_long(unsigned int address, unsigned int value) {
+  __real_cpu_write_long(address, value);
+  if (cached) predecode_write(address, 4);
+}
+
+static uint8_t *load(const char *name, size_t *size) {
+  FILE *f = fopen(name, "rb");
+  if (!f) {
+    perror(name);
+    exit(1);
+  }
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t *data = malloc(*size);
+  if (!data || fread(data, 1, *size, f) != *size) {
+    fprintf(stderr, "%s: read error\n", name);
+    exit(1);
+  }
+  fclose(f);
+  return data;
+}
+
+static int disc_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  memcpy(data, (uint8_t *) ctx + offset, len);
+  return 0;
+}
+
+static int disc_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  memcpy((uint8_t *) ctx + offset, data, len);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 5) {
+    fprintf(stderr, "usage: %s <rom.bin> <disc.img> <seconds> <0: Musashi, 1: predecode>\n", argv[0]);
+    return 1;
+  }
+  size_t rom_size, disc_size;
+  uint8_t *rom = load(argv[1], &rom_size);
+  uint8_t *disc = load(argv[2], &disc_size);
+  int seconds = atoi(argv[3]);
+  cached = atoi(argv[4]);
+  uint8_t *ram = calloc(1, RAM_SIZE);
+
+  disc_descr_t discs[DISC_NUM_DRIVES] = {0};
+  discs[0] = (disc_descr_t) {.base = 0, .read_only = 0, .size = disc_size, .op_ctx = disc,
+                             .op_read = disc_read, .op_write = disc_write};
+  if (cached) predecode_disc_attach(&discs[0], 0);
+  if (umac_init(ram, rom, discs) != 0) {
+    fprintf(stderr, "umac_init failed\n");
+    return 1;
+  }
+  predecode_init(ram);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int frame = 0; frame < seconds * 60; frame++) {
+    for (int i = 0; i < LOOPS_PER_VSYNC; i++) {
+      if (umac_loop()) break;
+    }
+    umac_vsync_event();
+    if (frame % 60 == 59) umac_1hz_event();
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  printf("seconds %.3f\n", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+  if (cached) {
+    printf("instructions %llu\n", (unsigned long long) predecode_stats.hits + predecode_stats.misses);
+    printf("hits %u misses %u invalidations %u\n", predecode_stats.hits, predecode_stats.misses,
+           predecode_stats.invalidations);
+  }
+  return 0;
+}
@@ -0,0 +1,113 @@
+/* Host test of the dirty line tracking (src/mem_hooks.c):
+ *
+ * Boots the patched ROM on a disc image for a number of emulated seconds with
+ * umac's memory accessors wrapped by src/mem_hooks.c (-Wl,--wrap, as on the
+ * Pico), and takes the dirty lines once per frame the way video_update()
+ * does. Prints, for every emulated second and for the whole run, how many of
+ * the lines shown on the 320x320 panel (no panning, so the top ones) would be
+ * pushed, against the 320 pushed per frame before lines were tracked.
+ *
+ * usage: umac-lines <rom.bin> <disc.img> <seconds>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "umac.h"
+#include "../src/mem_hooks.h"
+#include "../src/video.h"
+
+#define LOOPS_PER_VSYNC 26         // umac_loop() runs about 5000 cycles, a 60.15Hz frame is 130240
+#define SHOWN_LINES (DISP_HEIGHT < 320 ? DISP_HEIGHT : 320)
+
+volatile uint8_t video_dirty_lines[DISP_HEIGHT];
+
+static uint8_t *load(const char *name, size_t *size) {
+  FILE *f = fopen(name, "rb");
+  if (!f) {
+    perror(name);
+    exit(1);
+  }
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t *data = malloc(*size);
+  if (!data || fread(data, 1, *size, f) != *size) {
+    fprintf(stderr, "%s: read error\n", name);
+    exit(1);
+  }
+  fclose(f);
+  return data;
+}
+
+static int disc_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  memcpy(data, (uint8_t *) ctx + offset, len);
+  return 0;
+}
+
+static int disc_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  memcpy((uint8_t *) ctx + offset, data, len);
+  return 0;
+}
+
+// lines video_update() would push now, cleared as it does
+static int take_lines() {
+  int pushed = 0;
+  for (int line = 0; line < DISP_HEIGHT; line++) {
+    if (line < SHOWN_LINES && video_dirty_lines[line]) pushed++;
+    video_dirty_lines[line] = 0;
+  }
+  return pushed;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 4) {
+    fprintf(stderr, "usage: %s <rom.bin> <disc.img> <seconds>\n", argv[0]);
+    return 1;
+  }
+  size_t rom_size, disc_size;
+  uint8_t *rom = load(argv[1], &rom_size);
+  uint8_t *disc = load(argv[2], &disc_size);
+  int seconds = atoi(argv[3]);
+  uint8_t *ram = calloc(1, RAM_SIZE);
+
+  disc_descr_t discs[DISC_NUM_DRIVES] = {0};
+  discs[0] = (disc_descr_t) {.base = 0, .read_only = 0, .size = disc_size, .op_ctx = disc,
+                             .op_read = disc_read, .op_write = disc_write};
+  if (umac_init(ram, rom, discs) != 0) {
+    fprintf(stderr, "umac_init failed\n");
+    return 1;
+  }
+  mem_hooks_init(umac_get_fb_offset(), ram, rom);
+
+  unsigned long total = 0;
+  int most = 0, idle = 0, full = 0;
+  for (int second = 0; second < seconds; second++) {
+    int lines = 0;
+    for (int frame = 0; frame < 60; frame++) {
+      for (int i = 0; i < LOOPS_PER_VSYNC; i++) {
+        if (umac_loop()) break;
+      }
+      umac_vsync_event();
+      int pushed = take_lines();
+      lines += pushed;
+      if (pushed > most) most = pushed;
+      idle += pushed == 0;
+      full += pushed == SHOWN_LINES;
+    }
+    umac_1hz_event();
+    total += lines;
+    printf("second %d: %d lines, %d.%d per frame\n", second + 1, lines, lines / 60, lines * 10 / 60 % 10);
+  }
+
+  int frames = seconds * 60;
+  if (!frames) return 0;
+  printf("frames %d\n", frames);
+  printf("lines per frame %lu.%lu (of %d, most %d)\n", total / frames, total * 10 / frames % 10, SHOWN_LINES, most);
+  printf("frames with nothing to push %d, with every line %d\n", idle, full);
+  printf("pushed %lu.%lu%% of what redrawing every frame would\n", total * 100 / ((unsigned long) frames * SHOWN_LINES),
+         total * 1000 / ((unsigned long) frames * SHOWN_LINES) % 10);
+  return 0;
+}
@@ -0,0 +1,97 @@
+/* Host cost of UMAC_PROFILE (src/profile.c):
+ *
+ * Boots the patched ROM on a disc image for a number of emulated seconds with
+ * umac's memory accessors wrapped by src/mem_hooks.c (-Wl,--wrap, as on the
+ * Pico), and prints the host time taken. bench-profile in tools/check.sh
+ * builds it with and without -DUMAC_PROFILE=1: the emulated run is the same
+ * both ways, so the difference is what profiling costs, to hold against the
+ * overhead the profile prints with its table (dumped at the end of the
+ * profiled run).
+ *
+ * usage: umac-profile-bench <rom.bin> <disc.img> <seconds>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "umac.h"
+#include "../src/mem_hooks.h"
+#include "../src/profile.h"
+#include "../src/video.h"
+
+#define LOOPS_PER_VSYNC 26         // umac_loop() runs about 5000 cycles, a 60.15Hz frame is 130240
+
+volatile uint8_t video_dirty_lines[DISP_HEIGHT];
+
+static uint8_t *load(const char *name, size_t *size) {
+  FILE *f = fopen(name, "rb");
+  if (!f) {
+    perror(name);
+    exit(1);
+  }
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t *data = malloc(*size);
+  if (!data || fread(data, 1, *size, f) != *size) {
+    fprintf(stderr, "%s: read error\n", name);
+    exit(1);
+  }
+  fclose(f);
+  return data;
+}
+
+static int disc_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  memcpy(data, (uint8_t *) ctx + offset, len);
+  return 0;
+}
+
+static int disc_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  memcpy((uint8_t *) ctx + offset, data, len);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 4) {
+    fprintf(stderr, "usage: %s <rom.bin> <disc.img> <seconds>\n", argv[0]);
+    return 1;
+  }
+  size_t rom_size, disc_size;
+  uint8_t *rom = load(argv[1], &rom_size);
+  uint8_t *disc = load(argv[2], &disc_size);
+  int seconds = atoi(argv[3]);
+  uint8_t *ram = calloc(1, RAM_SIZE);
+
+  disc_descr_t discs[DISC_NUM_DRIVES] = {0};
+  discs[0] = (disc_descr_t) {.base = 0, .read_only = 0, .size = disc_size, .op_ctx = disc,
+                             .op_read = disc_read, .op_write = disc_write};
+  if (umac_init(ram, rom, discs) != 0) {
+    fprintf(stderr, "umac_init failed\n");
+    return 1;
+  }
+  mem_hooks_init(umac_get_fb_offset(), ram, rom);
+  profile_init();
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int frame = 0; frame < seconds * 60; frame++) {
+    PROFILE_BEGIN(PROFILE_LOOP);
+    for (int i = 0; i < LOOPS_PER_VSYNC; i++) {
+      if (umac_loop()) break;
+    }
+    PROFILE_END(PROFILE_LOOP);
+    umac_vsync_event();
+    memset((void *) video_dirty_lines, 0, sizeof(video_dirty_lines));
+    if (frame % 60 == 59) umac_1hz_event();
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  printf("seconds %.3f\n", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+#if UMAC_PROFILE
+  profile_dump();
+#endif
+  return 0;
+}
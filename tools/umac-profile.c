@@ -0,0 +1,135 @@
+/* Host profile of umac:
+ *
+ * Boots the patched ROM on a disc image for a number of emulated seconds,
+ * then wanders the mouse around and clicks now and then, and prints how many
+ * times each function was entered. The emulator is built with
+ * -finstrument-functions (see tools/gen-profile.sh), which calls
+ * __cyg_profile_func_enter() on every function entry; the addresses printed
+ * are turned into names with nm.
+ *
+ * Built with -DUMAC_PROFILE=1 and src/profile.c instead (no
+ * -finstrument-functions), the regions of src/profile.h that do not depend on
+ * link-time wraps are timed and their table is printed instead:
+ *   cc -O2 -DUMAC_PROFILE=1 <the defines and sources of tools/gen-profile.sh> src/profile.c
+ *
+ * usage: umac-profile <rom.bin> <disc.img> <seconds>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "umac.h"
+#include "../src/profile.h"
+
+#define PROFILE_SLOTS 65536        // functions, a power of two
+#define LOOPS_PER_VSYNC 26         // umac_loop() runs about 5000 cycles, a 60.15Hz frame is 130240
+#define BOOT_SECONDS 20
+
+#define NO_PROFILE __attribute__((no_instrument_function))
+
+static struct {
+  void *fn;
+  uint64_t count;
+} slots[PROFILE_SLOTS];
+
+void NO_PROFILE __cyg_profile_func_enter(void *fn, void *site) {
+  (void) site;
+  uintptr_t h = ((uintptr_t) fn >> 2) & (PROFILE_SLOTS - 1);
+  while (slots[h].fn && slots[h].fn != fn) h = (h + 1) & (PROFILE_SLOTS - 1);
+  slots[h].fn = fn;
+  slots[h].count++;
+}
+
+void NO_PROFILE __cyg_profile_func_exit(void *fn, void *site) {
+  (void) fn;
+  (void) site;
+}
+
+static uint8_t * NO_PROFILE load(const char *name, size_t *size) {
+  FILE *f = fopen(name, "rb");
+  if (!f) {
+    perror(name);
+    exit(1);
+  }
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t *data = malloc(*size);
+  if (!data || fread(data, 1, *size, f) != *size) {
+    fprintf(stderr, "%s: read error\n", name);
+    exit(1);
+  }
+  fclose(f);
+  return data;
+}
+
+// writes stay in memory, the image on disc is left as it is
+static int NO_PROFILE disc_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  memcpy(data, (uint8_t *) ctx + offset, len);
+  return 0;
+}
+
+static int NO_PROFILE disc_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len) {
+  memcpy((uint8_t *) ctx + offset, data, len);
+  return 0;
+}
+
+int NO_PROFILE main(int argc, char **argv) {
+  if (argc != 4) {
+    fprintf(stderr, "usage: %s <rom.bin> <disc.img> <seconds>\n", argv[0]);
+    return 1;
+  }
+  size_t rom_size, disc_size;
+  uint8_t *rom = load(argv[1], &rom_size);
+  uint8_t *disc = load(argv[2], &disc_size);
+  int seconds = atoi(argv[3]);
+  uint8_t *ram = calloc(1, RAM_SIZE);
+
+  disc_descr_t discs[DISC_NUM_DRIVES] = {0};
+  discs[0] = (disc_descr_t) {.base = 0, .read_only = 0, .size = disc_size, .op_ctx = disc,
+                             .op_read = disc_read, .op_write = disc_write};
+  profile_init();
+  profile_disc_attach(&discs[0], 0);
+  if (umac_init(ram, rom, discs) != 0) {
+    fprintf(stderr, "umac_init failed\n");
+    return 1;
+  }
+
+  srand(1);
+  int dx = 0, dy = 0, button = 0;
+  for (int frame = 0; frame < seconds * 60; frame++) {
+    for (int i = 0; i < LOOPS_PER_VSYNC; i++) {
+      PROFILE_BEGIN(PROFILE_LOOP);
+      int done = umac_loop();
+      PROFILE_END(PROFILE_LOOP);
+      if (done) break;
+    }
+    PROFILE_BEGIN(PROFILE_VSYNC);
+    umac_vsync_event();
+    PROFILE_END(PROFILE_VSYNC);
+    if (frame % 60 == 59) {
+      PROFILE_BEGIN(PROFILE_1HZ);
+      umac_1hz_event();
+      PROFILE_END(PROFILE_1HZ);
+    }
+    if (frame >= BOOT_SECONDS * 60 && frame % 4 == 0) {
+      if (frame % 120 == 0) {
+        dx = rand() % 9 - 4;
+        dy = rand() % 9 - 4;
+      }
+      button = frame % 240 < 8; // a click (or a drag) every 4 seconds
+      umac_mouse(dx, dy, button);
+    }
+  }
+
+#if UMAC_PROFILE
+  profile_dump();
+  return 0;
+#endif
+  for (int i = 0; i < PROFILE_SLOTS; i++) {
+    if (slots[i].fn) printf("%016lx %llu\n", (unsigned long) (uintptr_t) slots[i].fn, (unsigned long long) slots[i].count);
+  }
+  return 0;
+}
@@ -0,0 +1,178 @@
+/* Host test of src/video_conv.c:
+ *
+ * Checks that video_conv_row() gives, byte for byte, what the per-pixel loop
+ * it replaced in video_update() gave, for every byte offset into a line and
+ * every alignment of the source, on random and fixed patterns. Then checks
+ * video_fetch_span() followed by video_conv_row(), as panning uses them,
+ * against pixels read one by one, at every pan offset of lines 384 to 640
+ * pixels wide, with whatever follows the line changed to catch a span taking
+ * pixels past its end. Checks the overview's video_shrink_row() against an
+ * area average worked out pixel by pixel, for every line weighting of an
+ * output row. Last, times the conversion both ways on the same rows.
+ * The host is not the Pico, the ratio is what tells.
+ *
+ * usage: video-conv-test [rows to time]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "video_conv.h"
+
+#define LINE_BYTES 80              // 640 pixels, the widest display
+#define ROW_PIXELS 320
+#define ROW_BYTES (ROW_PIXELS / 2)
+#define PATTERNS 64
+
+// the loop of video_update() before video_conv_row(), from pixel x_offset
+static void old_row(uint8_t *row, const uint8_t *line, int x_offset) {
+  uint8_t* fb_out = row;
+  for (int x = 0; x < 320; x += 16) {
+    uint8_t plo = line[(x + x_offset)/8 + 0];
+    uint8_t phi = line[(x + x_offset)/8 + 1];
+    for (int i = 0; i < 8; i+=2) {
+      *fb_out++ = ((plo & (0x80 >> i)) ? 0 : 56) | ((plo & (0x80 >> (i + 1))? 0 : 7));
+    }
+    for (int i = 0; i < 8; i+=2) {
+      *fb_out++ = ((phi & (0x80 >> i)) ? 0 : 56) | ((phi & (0x80 >> (i + 1))? 0 : 7));
+    }
+  }
+}
+
+// the 320 pixels from x_offset, one at a time
+static void pixel_row(uint8_t *row, const uint8_t *line, int x_offset) {
+  for (int x = 0; x < ROW_PIXELS; x += 2) {
+    int hi = line[(x_offset + x) / 8] & (0x80 >> ((x_offset + x) % 8));
+    int lo = line[(x_offset + x + 1) / 8] & (0x80 >> ((x_offset + x + 1) % 8));
+    row[x / 2] = (hi ? 0 : 56) | (lo ? 0 : 7);
+  }
+}
+
+// every pan offset of lines of width pixels, returns the mismatches
+static int check_spans(const uint8_t *pattern, int width, int *checked) {
+  static uint32_t line[LINE_BYTES / 4 + 2];
+  static uint32_t span[ROW_PIXELS / 32];
+  uint8_t expected[ROW_BYTES];
+  uint8_t row[ROW_BYTES] __attribute__((aligned(4)));
+  int bad = 0;
+  memcpy(line, pattern, width / 8);
+  for (int offset = 0; offset + ROW_PIXELS <= width; offset++) {
+    pixel_row(expected, (uint8_t *) line, offset);
+    for (int guard = 0; guard < 2; guard++) {
+      memset((uint8_t *) line + width / 8, guard ? 0xff : 0x00, 8);
+      video_fetch_span(span, (uint8_t *) line, offset, ROW_PIXELS / 32);
+      video_conv_row(row, (uint8_t *) span, ROW_PIXELS / 8);
+      if (memcmp(row, expected, ROW_BYTES) != 0) {
+        if (bad++ < 10) printf("span mismatch: width %d, pan offset %d, guard %02x\n", width, offset, guard ? 0xff : 0);
+      }
+      (*checked)++;
+    }
+  }
+  return bad;
+}
+
+// gray of output pixel x of a shrunk row, in the order the panel takes it: the
+// overlap of source pixel s (5 fifths wide) and output pixel x (8 fifths) per line
+static void pixel_gray(uint8_t gray[2], const uint8_t *const lines[3], const uint8_t weights[3], int x) {
+  int black = 0;
+  for (int k = 0; k < 3; k++) {
+    for (int s = 8 * x / 5; s < LINE_BYTES * 8 && 5 * s < 8 * x + 8; s++) {
+      int lo = 5 * s > 8 * x ? 5 * s : 8 * x;
+      int hi = 5 * s + 5 < 8 * x + 8 ? 5 * s + 5 : 8 * x + 8;
+      if (lines[k][s / 8] & (0x80 >> s % 8)) black += weights[k] * (hi - lo);
+    }
+  }
+  int level = 255 - black * 255 / 64;
+  int rgb = (level >> 3) << 11 | (level >> 2) << 5 | (level >> 3);
+  gray[0] = rgb >> 8;
+  gray[1] = rgb;
+}
+
+static int check_shrink(const uint8_t lines[PATTERNS][LINE_BYTES], int *checked) {
+  static const uint8_t weights[5][3] = {{5, 3, 0}, {2, 5, 1}, {4, 4, 0}, {1, 5, 2}, {3, 5, 0}};
+  uint16_t row[LINE_BYTES * 5];
+  int bad = 0;
+  for (int p = 0; p < PATTERNS; p++) {
+    const uint8_t *const three[3] = {lines[p], lines[(p + 1) % PATTERNS], lines[(p + 7) % PATTERNS]};
+    for (int w = 0; w < 5; w++) {
+      video_shrink_row(row, three, weights[w], LINE_BYTES);
+      for (int x = 0; x < LINE_BYTES * 5; x++) {
+        uint8_t gray[2];
+        pixel_gray(gray, three, weights[w], x);
+        if (memcmp((uint8_t *) row + 2 * x, gray, 2) != 0 && bad++ < 10)
+          printf("shrink mismatch: pattern %d, weights %d, pixel %d\n", p, w, x);
+      }
+      (*checked)++;
+    }
+  }
+  return bad;
+}
+
+static double now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+  int rows = argc > 1 ? atoi(argv[1]) : 200000;
+  static uint8_t lines[PATTERNS][LINE_BYTES];
+  static uint8_t source[LINE_BYTES + 4] __attribute__((aligned(4)));
+  uint8_t expected[ROW_BYTES];
+  uint8_t row[ROW_BYTES] __attribute__((aligned(4)));
+
+  video_conv_init();
+  srand(1);
+  for (int p = 0; p < PATTERNS; p++)
+    for (int i = 0; i < LINE_BYTES; i++)
+      lines[p][i] = p == 0 ? 0x00 : p == 1 ? 0xff : p == 2 ? 0xaa : p == 3 ? 0x55 : p == 4 ? i : rand();
+
+  int checked = 0, bad = 0;
+  for (int p = 0; p < PATTERNS; p++) {
+    for (int offset = 0; offset + ROW_PIXELS / 8 <= LINE_BYTES; offset++) {
+      old_row(expected, lines[p], offset * 8);
+      for (int align = 0; align < 4; align++) {
+        memcpy(source + align, lines[p] + offset, ROW_PIXELS / 8);
+        memset(row, 0xee, ROW_BYTES);
+        video_conv_row(row, source + align, ROW_PIXELS / 8);
+        if (memcmp(row, expected, ROW_BYTES) != 0) {
+          if (bad++ < 10) printf("mismatch: pattern %d, byte offset %d, alignment %d\n", p, offset, align);
+        }
+        checked++;
+      }
+    }
+  }
+  printf("rows checked %d, mismatches %d\n", checked, bad);
+
+  int spans = 0, span_bad = 0;
+  for (int p = 0; p < PATTERNS; p++)
+    for (int width = 384; width <= LINE_BYTES * 8; width += 128)
+      span_bad += check_spans(lines[p], width, &spans);
+  printf("pan offsets checked %d, mismatches %d\n", spans, span_bad);
+  bad += span_bad;
+
+  int shrunk = 0, shrink_bad = check_shrink(lines, &shrunk);
+  printf("overview rows checked %d, mismatches %d\n", shrunk, shrink_bad);
+  bad += shrink_bad;
+
+  uint32_t sum = 0;
+  double start = now();
+  for (int r = 0; r < rows; r++) {
+    old_row(row, lines[r % PATTERNS], (r % 8) * 8);
+    sum += row[r % ROW_BYTES];
+  }
+  double old_s = now() - start;
+  start = now();
+  for (int r = 0; r < rows; r++) {
+    video_conv_row(row, lines[r % PATTERNS] + r % 8, ROW_PIXELS / 8);
+    sum += row[r % ROW_BYTES];
+  }
+  double new_s = now() - start;
+  printf("old loop:       %.1f ns per 320 pixel row\n", old_s * 1e9 / rows);
+  printf("video_conv_row: %.1f ns per 320 pixel row\n", new_s * 1e9 / rows);
+  printf("speedup:        %.2fx (checksum %u)\n", old_s / new_s, (unsigned) sum);
+  return bad != 0;
+}